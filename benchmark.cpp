@@ -0,0 +1,189 @@
+#include "benchmark.h"
+#include "common.h"
+#include "hardwareinfo.h"
+#include "mediaprobe.h"
+#include "modelvariants.h"
+
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTemporaryDir>
+#include <QDebug>
+
+#include <atomic>
+#include <thread>
+
+Benchmark::Benchmark(const QString &directory) {
+    const QFileInfoList entries = QDir(directory).entryInfoList(QDir::Files, QDir::Name);
+    for (const auto &entry : entries) {
+        if (entry.suffix() == "txt" || MediaProbe::container(entry.absoluteFilePath()) == MediaProbe::Unknown) {
+            continue;
+        }
+        const QString reference = entry.absolutePath() + "/" + entry.completeBaseName() + ".txt";
+        if (QFileInfo::exists(reference)) {
+            pairs.append(qMakePair(entry.absoluteFilePath(), reference));
+        }
+    }
+}
+
+QVector<BenchmarkConfig> Benchmark::configs(const QStringList &specs, const whisper_params &base) {
+    QVector<BenchmarkConfig> result;
+    for (const auto &spec : specs) {
+        BenchmarkConfig config;
+        config.name = spec;
+        config.params = base;
+
+        const QString kind = spec.section('@', 0, 0);
+        const QString model = spec.section('@', 1);
+        if (ModelVariants::supportedTypes().contains(model)) {
+            config.params.model_variant = model.toStdString();
+        } else if (!model.isEmpty()) {
+            config.params.model = model.toStdString();
+        }
+
+        if (kind == "full-ctx") {
+            config.params.auto_audio_ctx = false;
+        } else if (!Transcriber::setDecoding(config.params, kind)) {
+            qWarning() << "benchmark: unknown configuration" << spec;
+            continue;
+        }
+        result.append(config);
+    }
+    return result;
+}
+
+QStringList Benchmark::normalizeWords(const QString &text) {
+    QString clean;
+    clean.reserve(text.size());
+    for (const QChar c : text) {
+        clean.append(c.isLetterOrNumber() || c == '\'' ? c.toLower() : QChar(' '));
+    }
+    return clean.split(' ', Qt::SkipEmptyParts);
+}
+
+void Benchmark::score(const QString &reference, const QString &hypothesis, int &wordErrors, int &words, int &charErrors, int &chars) {
+    const QStringList ref = normalizeWords(reference);
+    const QStringList hyp = normalizeWords(hypothesis);
+
+    // words become symbols, the same bit-parallel alignment as for characters
+    QHash<QString, uint32_t> ids;
+    auto toSymbols = [&ids](const QStringList &list) {
+        std::vector<uint32_t> symbols;
+        symbols.reserve(list.size());
+        for (const auto &word : list) {
+            auto it = ids.find(word);
+            if (it == ids.end()) {
+                it = ids.insert(word, uint32_t(ids.size()));
+            }
+            symbols.push_back(it.value());
+        }
+        return symbols;
+    };
+    const std::vector<uint32_t> refWords = toSymbols(ref);
+    const std::vector<uint32_t> hypWords = toSymbols(hyp);
+    wordErrors = edit_distance(refWords, hypWords);
+    words = int(refWords.size());
+
+    auto toCodePoints = [](const QStringList &list) {
+        const QVector<uint> ucs4 = list.join(' ').toUcs4();
+        return std::vector<uint32_t>(ucs4.begin(), ucs4.end());
+    };
+    const std::vector<uint32_t> refChars = toCodePoints(ref);
+    const std::vector<uint32_t> hypChars = toCodePoints(hyp);
+    charErrors = edit_distance(refChars, hypChars);
+    chars = int(refChars.size());
+}
+
+// transcript text of a JSON written by Transcriber, false when there is none
+static bool transcriptText(const QString &file, QString &text) {
+    QFile json(file);
+    if (!json.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+    QJsonParseError error;
+    const QJsonDocument document = QJsonDocument::fromJson(json.readAll(), &error);
+    if (error.error != QJsonParseError::NoError) {
+        return false;
+    }
+    const QJsonObject root = document.object();
+    QStringList segments;
+    for (const auto &segment : root.value("transcription").toArray()) {
+        segments.append(segment.toObject().value("text").toString());
+    }
+    text = segments.join(' ');
+    return true;
+}
+
+BenchmarkResult Benchmark::run(const BenchmarkConfig &config) const {
+    BenchmarkResult result;
+    result.config = config.name;
+
+    QTemporaryDir output;
+    if (!output.isValid()) {
+        return result;
+    }
+
+    // resident set sampled in the background, the peak covers model load and decoding
+    std::atomic<bool> done(false);
+    std::atomic<qint64> peak(HardwareInfo::residentMemoryBytes());
+    std::thread sampler([&done, &peak]() {
+        while (!done.load()) {
+            peak = qMax<qint64>(peak.load(), HardwareInfo::residentMemoryBytes());
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        }
+    });
+
+    int wordErrors = 0, words = 0, charErrors = 0, chars = 0;
+    double audioSeconds = 0.0;
+    qint64 elapsedNs = 0;
+    for (const auto &pair : pairs) {
+        QFile reference(pair.second);
+        if (!reference.open(QIODevice::ReadOnly | QIODevice::Text)) {
+            qWarning() << "benchmark: skipping" << pair.first << "- cannot read" << pair.second << reference.errorString();
+            result.failed++;
+            continue;
+        }
+
+        QElapsedTimer timer;
+        timer.start();
+        std::atomic<bool> abortFlag(false);
+        Transcriber transcriber(&abortFlag);
+        transcriber.setParams(config.params);
+        transcriber.setFileAndOutput(pair.first, output.path());
+        transcriber.startTranscription();
+        const qint64 fileNs = timer.nsecsElapsed();
+
+        // a failed transcription is not a transcript with every word deleted
+        QString hypothesis;
+        if (!transcriptText(output.path() + "/" + QFileInfo(pair.first).completeBaseName() + ".json", hypothesis)) {
+            qWarning() << "benchmark: skipping" << pair.first << "- no transcript written";
+            result.failed++;
+            continue;
+        }
+        elapsedNs += fileNs;
+
+        int we = 0, w = 0, ce = 0, c = 0;
+        score(QString::fromUtf8(reference.readAll()), hypothesis, we, w, ce, c);
+        wordErrors += we;
+        words += w;
+        charErrors += ce;
+        chars += c;
+        audioSeconds += qMax<qint64>(0, MediaProbe::durationMs(pair.first)) / 1000.0;
+        result.files++;
+    }
+    result.seconds = elapsedNs / 1e9;
+
+    done = true;
+    sampler.join();
+
+    result.wer = words > 0 ? double(wordErrors) / words : 0.0;
+    result.cer = chars > 0 ? double(charErrors) / chars : 0.0;
+    result.rtf = audioSeconds > 0.0 ? result.seconds / audioSeconds : 0.0;
+    result.peakRssBytes = peak.load();
+    return result;
+}
@@ -0,0 +1,51 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QPair>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include "transcriber.h"
+
+struct BenchmarkConfig {
+    QString name;
+    whisper_params params;
+};
+
+struct BenchmarkResult {
+    QString config;
+    int files = 0;             // scored files
+    int failed = 0;            // files without a transcript or readable reference, not scored
+    double wer = 0.0;          // word error rate over all files, errors / reference words
+    double cer = 0.0;          // character error rate, same over code points
+    double rtf = 0.0;          // processing time / audio duration
+    double seconds = 0.0;
+    qint64 peakRssBytes = 0;
+};
+
+// Runs the transcriber over a directory of audio files with reference transcripts
+// (<name>.txt next to <name>.wav/.mp4/...) under several configurations, so every
+// speed setting is reported together with its accuracy cost.
+class Benchmark {
+public:
+    explicit Benchmark(const QString &directory);
+
+    // audio file and reference text pairs found in the directory
+    const QVector<QPair<QString, QString>> &samples() const { return pairs; }
+
+    // "greedy", "full-ctx", "beam", "adaptive", each optionally "@<model path>"
+    static QVector<BenchmarkConfig> configs(const QStringList &specs, const whisper_params &base);
+
+    BenchmarkResult run(const BenchmarkConfig &config) const;
+
+    // lowercase words without punctuation
+    static QStringList normalizeWords(const QString &text);
+
+    // word and character edit distances, and the reference lengths they are relative to
+    static void score(const QString &reference, const QString &hypothesis, int &wordErrors, int &words, int &charErrors, int &chars);
+
+private:
+    QVector<QPair<QString, QString>> pairs;
+};
+
+#endif // BENCHMARK_H
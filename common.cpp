@@ -7,13 +7,17 @@
 #define DR_WAV_IMPLEMENTATION
 #include "dr_wav.h"
 
+#include <algorithm>
 #include <cmath>
+#include <cstdint>
 #include <cstring>
 #include <fstream>
 #include <regex>
 #include <locale>
+#include <memory>
 #include <codecvt>
 #include <sstream>
+#include <thread>
 
 #if defined(_MSC_VER)
 #pragma warning(disable: 4244 4267) // possible loss of data
@@ -22,11 +26,16 @@
 #ifdef _WIN32
 #include <fcntl.h>
 #include <io.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #endif
 
 #ifdef WHISPER_FFMPEG
-// as implemented in ffmpeg_trancode.cpp only embedded in common lib if whisper built with ffmpeg support
-extern bool ffmpeg_decode_audio(const std::string & ifname, std::vector<uint8_t> & wav_data);
+// as implemented in whisper.cpp/examples/ffmpeg-transcode.cpp, compiled in when built with WHISPER_FFMPEG
+// decodes any container libav understands to 16 kHz mono 16-bit WAV in memory, 0 on success
+extern int ffmpeg_decode_audio(const std::string & ifname, std::vector<uint8_t> & wav_data);
 #endif
 
 // Function to check if the next argument exists
@@ -640,33 +649,355 @@ bool is_wav_buffer(const std::string buf) {
     return true;
 }
 
+// convert interleaved 16-bit frames to mono float (and split stereo), appending to the outputs
+static void append_pcm16(const int16_t * src, size_t n, int channels, std::vector<float> & pcmf32, std::vector<std::vector<float>> & pcmf32s, bool stereo) {
+    const size_t n0 = pcmf32.size();
+    pcmf32.resize(n0 + n);
+    if (channels == 1) {
+        for (size_t i = 0; i < n; i++) {
+            pcmf32[n0 + i] = float(src[i])/32768.0f;
+        }
+    } else {
+        for (size_t i = 0; i < n; i++) {
+            pcmf32[n0 + i] = float(src[2*i] + src[2*i + 1])/65536.0f;
+        }
+    }
+
+    if (stereo) {
+        pcmf32s.resize(2);
+        pcmf32s[0].resize(n0 + n);
+        pcmf32s[1].resize(n0 + n);
+        for (size_t i = 0; i < n; i++) {
+            pcmf32s[0][n0 + i] = float(src[2*i])/32768.0f;
+            pcmf32s[1][n0 + i] = float(src[2*i + 1])/32768.0f;
+        }
+    }
+}
+
+// average all channels of interleaved float frames into mono
+static void downmix_f32(const float * src, size_t n, int channels, std::vector<float> & mono) {
+    mono.resize(n);
+    if (channels == 1) {
+        std::copy(src, src + n, mono.begin());
+        return;
+    }
+    const float scale = 1.0f/channels;
+    for (size_t i = 0; i < n; i++) {
+        float sum = 0.0f;
+        for (int c = 0; c < channels; c++) {
+            sum += src[i*channels + c];
+        }
+        mono[i] = sum*scale;
+    }
+}
+
+static bool check_wav_format(const std::string & fname, uint32_t channels, bool stereo) {
+    if (channels == 0) {
+        fprintf(stderr, "%s: WAV file '%s' has no channels\n", __func__, fname.c_str());
+        return false;
+    }
+
+    if (stereo && channels != 2) {
+        fprintf(stderr, "%s: WAV file '%s' must be stereo for diarization\n", __func__, fname.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+static double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; k++) {
+        term *= (x/(2.0*k))*(x/(2.0*k));
+        sum += term;
+        if (term < sum*1e-12) {
+            break;
+        }
+    }
+    return sum;
+}
+
+polyphase_resampler::polyphase_resampler(int rate_in, int rate_out) {
+    int a = rate_in;
+    int b = rate_out;
+    while (b != 0) {
+        const int t = a % b;
+        a = b;
+        b = t;
+    }
+    up   = rate_out/a;
+    down = rate_in/a;
+
+    // prototype low-pass at the upsampled rate: passband to 0.88 of the lower of the two Nyquist
+    // frequencies, 85 dB down from that Nyquist frequency on (Kaiser's formulas for beta and length)
+    const double nyquist     = 0.5/std::max(up, down);
+    const double cutoff      = 0.94*nyquist;
+    const double stopband_db = 85.0;
+    const double beta        = 0.1102*(stopband_db - 8.7);
+    const double width       = 2.0*M_PI*0.12*nyquist;
+    const int    n_needed    = int(std::ceil((stopband_db - 8.0)/(2.285*width))) + 1;
+    taps = (n_needed + up - 1)/up;
+
+    // odd length so the center falls on a sample, the last slot of the table stays zero
+    const int    n_proto = taps*up - 1 + (taps*up) % 2;
+    const double center  = 0.5*(n_proto - 1);
+
+    std::vector<double> proto(size_t(taps)*up, 0.0);
+    for (int k = 0; k < n_proto; k++) {
+        const double x = k - center;
+        const double sinc = x == 0.0 ? 2.0*cutoff : sin(2.0*M_PI*cutoff*x)/(M_PI*x);
+        const double r = 2.0*k/(n_proto - 1) - 1.0;
+        proto[k] = sinc*bessel_i0(beta*sqrt(std::max(0.0, 1.0 - r*r)))/bessel_i0(beta);
+    }
+
+    // split into phases, each normalized to unity DC gain and stored reversed so the
+    // dot product runs over contiguous, increasing input samples
+    coeffs.resize(size_t(up)*taps);
+    for (int p = 0; p < up; p++) {
+        double sum = 0.0;
+        for (int j = 0; j < taps; j++) {
+            sum += proto[p + j*up];
+        }
+        for (int j = 0; j < taps; j++) {
+            coeffs[size_t(p)*taps + (taps - 1 - j)] = float(proto[p + j*up]/sum);
+        }
+    }
+
+    // history of zeros, the first output is aligned with the filter center
+    buf.assign(taps - 1, 0.0f);
+    next = uint64_t(taps - 1)*up + uint64_t(center);
+}
+
+// dot product with independent partial sums, vectorizes without -ffast-math
+static inline float dot_f32(const float * a, const float * b, int n) {
+    float acc[8] = { 0.0f };
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        for (int k = 0; k < 8; k++) {
+            acc[k] += a[i + k]*b[i + k];
+        }
+    }
+    float sum = ((acc[0] + acc[4]) + (acc[1] + acc[5])) + ((acc[2] + acc[6]) + (acc[3] + acc[7]));
+    for (; i < n; i++) {
+        sum += a[i]*b[i];
+    }
+    return sum;
+}
+
+void polyphase_resampler::process(const float * in, size_t n, std::vector<float> & out) {
+    buf.insert(buf.end(), in, in + n);
+    n_in += n;
+    drain(out);
+}
+
+void polyphase_resampler::flush(std::vector<float> & out) {
+    // zeros past the end let the outputs held back by the filter delay be computed
+    buf.insert(buf.end(), taps, 0.0f);
+    drain(out);
+}
+
+void polyphase_resampler::drain(std::vector<float> & out) {
+    // never produce more than the input length maps to, flush() pads with zeros
+    const uint64_t n_out_max = (n_in*up + down - 1)/down;
+
+    while (n_out < n_out_max) {
+        const uint64_t base = next/up; // newest input sample used by this output
+        if (base >= buf.size()) {
+            break;
+        }
+        const int phase = int(next % up);
+        out.push_back(dot_f32(&coeffs[size_t(phase)*taps], &buf[base - (taps - 1)], taps));
+        next += down;
+        n_out++;
+    }
+
+    // drop input no longer reachable by the filter
+    const uint64_t base = std::min<uint64_t>(next/up, buf.size());
+    if (base > uint64_t(taps - 1)) {
+        const uint64_t drop = base - (taps - 1);
+        buf.erase(buf.begin(), buf.begin() + drop);
+        next -= drop*up;
+    }
+}
+
+// read exactly n bytes unless the stream ends
+static size_t fread_full(void * dst, size_t n, FILE * f) {
+    size_t got = 0;
+    while (got < n) {
+        const size_t r = fread((uint8_t *) dst + got, 1, n - got, f);
+        if (r == 0) {
+            break;
+        }
+        got += r;
+    }
+    return got;
+}
+
+// Read a WAV from a pipe: parse the RIFF header first, then convert the data chunk
+// block by block so no copy of the whole input is ever held besides the float output.
+// Input that needs format or rate conversion is slurped into wav_data for dr_wav instead.
+static bool read_wav_stdin(std::vector<uint8_t> & wav_data, std::vector<float> & pcmf32, std::vector<std::vector<float>> & pcmf32s, bool stereo, bool & decoded) {
+    decoded = false;
+
+    uint8_t riff[12];
+    size_t n_header = fread_full(riff, sizeof(riff), stdin);
+    wav_data.assign(riff, riff + n_header);
+    if (n_header < sizeof(riff) || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        return false;
+    }
+
+    uint16_t format   = 0;
+    uint16_t channels = 0;
+    uint32_t sample_rate = 0;
+    uint16_t bits_per_sample = 0;
+
+    while (true) {
+        uint8_t chunk[8];
+        if (fread_full(chunk, sizeof(chunk), stdin) != sizeof(chunk)) {
+            return false;
+        }
+        wav_data.insert(wav_data.end(), chunk, chunk + sizeof(chunk));
+
+        uint32_t size;
+        memcpy(&size, chunk + 4, 4);
+
+        if (memcmp(chunk, "data", 4) == 0) {
+            if (format != 1 || bits_per_sample != 16 || sample_rate != COMMON_SAMPLE_RATE || (channels != 1 && channels != 2)) {
+                break; // conversion needed, let dr_wav and the resampler deal with it
+            }
+            if (!check_wav_format("-", channels, stereo)) {
+                return false;
+            }
+
+            // streamed WAVs (ffmpeg to a pipe) carry a bogus size and run to EOF, otherwise the
+            // size bounds the samples and chunks after it (LIST, id3) are not audio
+            const size_t frame_size = size_t(channels) * 2;
+            const bool sized = size != 0 && size != 0xFFFFFFFF;
+            size_t remaining = sized ? size_t(size) : SIZE_MAX;
+            if (sized) {
+                pcmf32.reserve(size / frame_size);
+                if (stereo) {
+                    pcmf32s.resize(2);
+                    pcmf32s[0].reserve(size / frame_size);
+                    pcmf32s[1].reserve(size / frame_size);
+                }
+            }
+
+            // large reads into one reused block, a partial frame is carried into the next read
+            std::vector<int16_t> block(1 << 19);
+            const size_t block_bytes = block.size() * sizeof(int16_t);
+            size_t carry = 0;
+            size_t total = 0;
+            while (remaining > 0) {
+                const size_t r = fread((uint8_t *) block.data() + carry, 1, std::min(block_bytes - carry, remaining), stdin);
+                if (r == 0) {
+                    break;
+                }
+                remaining -= r;
+                const size_t avail = carry + r;
+                const size_t frames = avail / frame_size;
+                append_pcm16(block.data(), frames, channels, pcmf32, pcmf32s, stereo);
+                carry = avail - frames * frame_size;
+                memmove(block.data(), (uint8_t *) block.data() + frames * frame_size, carry);
+                total += r;
+            }
+
+            fprintf(stderr, "%s: read %zu bytes from stdin\n", __func__, total + wav_data.size());
+            wav_data.clear();
+            decoded = true;
+            return true;
+        }
+
+        // header chunks are small, keep them for the dr_wav fallback
+        std::vector<uint8_t> body(size + (size & 1));
+        if (fread_full(body.data(), body.size(), stdin) != body.size()) {
+            return false;
+        }
+        wav_data.insert(wav_data.end(), body.begin(), body.end());
+
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            memcpy(&format, body.data() + 0, 2);
+            memcpy(&channels, body.data() + 2, 2);
+            memcpy(&sample_rate, body.data() + 4, 4);
+            memcpy(&bits_per_sample, body.data() + 14, 2);
+        }
+    }
+
+    // slurp the rest with large reads into a geometrically grown buffer
+    size_t used = wav_data.size();
+    wav_data.resize(std::max<size_t>(used * 2, 1 << 20));
+    while (true) {
+        const size_t r = fread(wav_data.data() + used, 1, wav_data.size() - used, stdin);
+        if (r == 0) {
+            break;
+        }
+        used += r;
+        if (used == wav_data.size()) {
+            wav_data.resize(wav_data.size() * 2);
+        }
+    }
+    wav_data.resize(used);
+    fprintf(stderr, "%s: read %zu bytes from stdin\n", __func__, wav_data.size());
+    return true;
+}
+
 bool read_wav(const std::string & fname, std::vector<float>& pcmf32, std::vector<std::vector<float>>& pcmf32s, bool stereo) {
     drwav wav;
     std::vector<uint8_t> wav_data; // used for pipe input from stdin or ffmpeg decoding output
+    const uint8_t * wav_mem = nullptr;
+    size_t wav_mem_size = 0;
+
+#ifndef _WIN32
+    void * mapped = nullptr;
+    size_t mapped_size = 0;
+#endif
+
+    pcmf32.clear();
+    pcmf32s.clear();
 
     if (fname == "-") {
-        {
-            #ifdef _WIN32
-            _setmode(_fileno(stdin), _O_BINARY);
-            #endif
-
-            uint8_t buf[1024];
-            while (true)
-            {
-                const size_t n = fread(buf, 1, sizeof(buf), stdin);
-                if (n == 0) {
-                    break;
-                }
-                wav_data.insert(wav_data.end(), buf, buf + n);
+        #ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+        #else
+        // stdin redirected from a file: map it instead of copying it
+        struct stat st;
+        const int fd = fileno(stdin);
+        const off_t pos = lseek(fd, 0, SEEK_CUR);
+        if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && pos >= 0 && st.st_size > pos) {
+            mapped_size = size_t(st.st_size);
+            mapped = mmap(nullptr, mapped_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED) {
+                mapped = nullptr;
+            } else {
+                wav_mem = (const uint8_t *) mapped + pos;
+                wav_mem_size = mapped_size - size_t(pos);
             }
         }
+        #endif
 
-        if (drwav_init_memory(&wav, wav_data.data(), wav_data.size(), nullptr) == false) {
+        if (!wav_mem) {
+            bool decoded = false;
+            if (!read_wav_stdin(wav_data, pcmf32, pcmf32s, stereo, decoded)) {
+                fprintf(stderr, "error: failed to open WAV file from stdin\n");
+                return false;
+            }
+            if (decoded) {
+                return true;
+            }
+            wav_mem = wav_data.data();
+            wav_mem_size = wav_data.size();
+        }
+
+        if (drwav_init_memory(&wav, wav_mem, wav_mem_size, nullptr) == false) {
             fprintf(stderr, "error: failed to open WAV file from stdin\n");
+#ifndef _WIN32
+            if (mapped) {
+                munmap(mapped, mapped_size);
+            }
+#endif
             return false;
         }
-
-        fprintf(stderr, "%s: read %zu bytes from stdin\n", __func__, wav_data.size());
     }
     else if (is_wav_buffer(fname)) {
         if (drwav_init_memory(&wav, fname.c_str(), fname.size(), nullptr) == false) {
@@ -674,7 +1005,11 @@ bool read_wav(const std::string & fname, std::vector<float>& pcmf32, std::vector
             return false;
         }
     }
-    else if (drwav_init_file(&wav, fname.c_str(), nullptr) == false) {
+    else if (drwav_init_file(&wav, fname.c_str(), nullptr)) {
+        std::ifstream f(fname, std::ios::binary | std::ios::ate);
+        wav_mem_size = f ? size_t(f.tellg()) : 0;
+    }
+    else {
 #if defined(WHISPER_FFMPEG)
         if (ffmpeg_decode_audio(fname, wav_data) != 0) {
             fprintf(stderr, "error: failed to ffmpeg decode '%s' \n", fname.c_str());
@@ -684,68 +1019,98 @@ bool read_wav(const std::string & fname, std::vector<float>& pcmf32, std::vector
             fprintf(stderr, "error: failed to read wav data as wav \n");
             return false;
         }
+        wav_mem_size = wav_data.size();
 #else
         fprintf(stderr, "error: failed to open '%s' as WAV file\n", fname.c_str());
         return false;
 #endif
     }
 
-    if (wav.channels != 1 && wav.channels != 2) {
-        fprintf(stderr, "%s: WAV file '%s' must be mono or stereo\n", __func__, fname.c_str());
-        drwav_uninit(&wav);
-        return false;
-    }
+    bool ok = check_wav_format(fname, wav.channels, stereo);
 
-    if (stereo && wav.channels != 2) {
-        fprintf(stderr, "%s: WAV file '%s' must be stereo for diarization\n", __func__, fname.c_str());
-        drwav_uninit(&wav);
-        return false;
-    }
+    if (ok) {
+        // WAVs written to pipes may carry a bogus frame count, bound it by the bytes present
+        uint64_t n = wav.totalPCMFrameCount;
+        if (wav_mem_size > 0 && wav.bitsPerSample > 0) {
+            n = std::min<uint64_t>(n, wav_mem_size/(wav.channels*wav.bitsPerSample/8));
+        }
+        const int  channels = wav.channels;
+        const bool convert  = wav.sampleRate != COMMON_SAMPLE_RATE;
+        pcmf32.reserve(convert ? n*COMMON_SAMPLE_RATE/wav.sampleRate + 1 : n);
 
-    if (wav.sampleRate != COMMON_SAMPLE_RATE) {
-        fprintf(stderr, "%s: WAV file '%s' must be %i kHz\n", __func__, fname.c_str(), COMMON_SAMPLE_RATE/1000);
-        drwav_uninit(&wav);
-        return false;
-    }
+        if (convert) {
+            fprintf(stderr, "%s: resampling '%s' from %u Hz to %d Hz\n", __func__, fname.c_str(), wav.sampleRate, COMMON_SAMPLE_RATE);
+        }
 
-    if (wav.bitsPerSample != 16) {
-        fprintf(stderr, "%s: WAV file '%s' must be 16-bit\n", __func__, fname.c_str());
-        drwav_uninit(&wav);
-        return false;
-    }
+        // filter tables only when there is something to convert, and per channel only when needed
+        std::unique_ptr<polyphase_resampler> resampler;
+        std::unique_ptr<polyphase_resampler> resampler_l;
+        std::unique_ptr<polyphase_resampler> resampler_r;
+        if (convert) {
+            resampler.reset(new polyphase_resampler(wav.sampleRate, COMMON_SAMPLE_RATE));
+            if (stereo) {
+                resampler_l.reset(new polyphase_resampler(wav.sampleRate, COMMON_SAMPLE_RATE));
+                resampler_r.reset(new polyphase_resampler(wav.sampleRate, COMMON_SAMPLE_RATE));
+            }
+        }
+        if (stereo) {
+            pcmf32s.resize(2);
+        }
 
-    const uint64_t n = wav_data.empty() ? wav.totalPCMFrameCount : wav_data.size()/(wav.channels*wav.bitsPerSample/8);
+        // decode any sample format to float in blocks, downmix and resample straight into the output
+        std::vector<float> block(size_t(1 << 16) * channels);
+        std::vector<float> mono;
+        std::vector<float> left;
+        std::vector<float> right;
+        while (n > 0) {
+            const uint64_t want = std::min<uint64_t>(n, block.size() / channels);
+            const uint64_t got = drwav_read_pcm_frames_f32(&wav, want, block.data());
+            if (got == 0) {
+                break;
+            }
+            n -= got;
 
-    std::vector<int16_t> pcm16;
-    pcm16.resize(n*wav.channels);
-    drwav_read_pcm_frames_s16(&wav, n, pcm16.data());
-    drwav_uninit(&wav);
+            downmix_f32(block.data(), got, channels, mono);
+            if (convert) {
+                resampler->process(mono.data(), mono.size(), pcmf32);
+            } else {
+                pcmf32.insert(pcmf32.end(), mono.begin(), mono.end());
+            }
 
-    // convert to mono, float
-    pcmf32.resize(n);
-    if (wav.channels == 1) {
-        for (uint64_t i = 0; i < n; i++) {
-            pcmf32[i] = float(pcm16[i])/32768.0f;
+            if (stereo) {
+                left.resize(got);
+                right.resize(got);
+                for (uint64_t i = 0; i < got; i++) {
+                    left[i]  = block[2*i];
+                    right[i] = block[2*i + 1];
+                }
+                if (convert) {
+                    resampler_l->process(left.data(), left.size(), pcmf32s[0]);
+                    resampler_r->process(right.data(), right.size(), pcmf32s[1]);
+                } else {
+                    pcmf32s[0].insert(pcmf32s[0].end(), left.begin(), left.end());
+                    pcmf32s[1].insert(pcmf32s[1].end(), right.begin(), right.end());
+                }
+            }
         }
-    } else {
-        for (uint64_t i = 0; i < n; i++) {
-            pcmf32[i] = float(pcm16[2*i] + pcm16[2*i + 1])/65536.0f;
+
+        if (convert) {
+            resampler->flush(pcmf32);
+            if (stereo) {
+                resampler_l->flush(pcmf32s[0]);
+                resampler_r->flush(pcmf32s[1]);
+            }
         }
     }
 
-    if (stereo) {
-        // convert to stereo, float
-        pcmf32s.resize(2);
-
-        pcmf32s[0].resize(n);
-        pcmf32s[1].resize(n);
-        for (uint64_t i = 0; i < n; i++) {
-            pcmf32s[0][i] = float(pcm16[2*i])/32768.0f;
-            pcmf32s[1][i] = float(pcm16[2*i + 1])/32768.0f;
-        }
+    drwav_uninit(&wav);
+#ifndef _WIN32
+    if (mapped) {
+        munmap(mapped, mapped_size);
     }
+#endif
 
-    return true;
+    return ok;
 }
 
 void high_pass_filter(std::vector<float> & data, float cutoff, float sample_rate) {
@@ -799,28 +1164,330 @@ bool vad_simple(std::vector<float> & pcmf32, int sample_rate, int last_ms, float
     return true;
 }
 
-float similarity(const std::string & s0, const std::string & s1) {
-    const size_t len0 = s0.size() + 1;
-    const size_t len1 = s1.size() + 1;
+static const int kMelFftSize = 400;  // 25 ms at 16 kHz
+static const int kMelHopSize = 160;  // 10 ms at 16 kHz
+
+// mixed radix FFT of n real samples into n interleaved complex values, n divides kMelFftSize
+// scratch holds 6 * n floats, cos_t and sin_t are tables for kMelFftSize
+static void mel_fft(const float * in, int n, float * out, float * scratch, const float * cos_t, const float * sin_t) {
+    if (n == 1) {
+        out[0] = in[0];
+        out[1] = 0.0f;
+        return;
+    }
+
+    const int step = kMelFftSize / n;
+    if (n % 2 == 1) {
+        for (int k = 0; k < n; k++) {
+            float re = 0.0f;
+            float im = 0.0f;
+            for (int j = 0; j < n; j++) {
+                const int idx = (k * j % n) * step;
+                re += in[j] * cos_t[idx];
+                im -= in[j] * sin_t[idx];
+            }
+            out[2 * k + 0] = re;
+            out[2 * k + 1] = im;
+        }
+        return;
+    }
+
+    const int half = n / 2;
+    float * even = scratch;
+    float * odd = scratch + half;
+    float * even_fft = scratch + n;
+    float * odd_fft = scratch + 2 * n;
+    for (int i = 0; i < half; i++) {
+        even[i] = in[2 * i + 0];
+        odd[i] = in[2 * i + 1];
+    }
+    mel_fft(even, half, even_fft, scratch + 3 * n, cos_t, sin_t);
+    mel_fft(odd, half, odd_fft, scratch + 3 * n, cos_t, sin_t);
+
+    for (int k = 0; k < half; k++) {
+        const float re = cos_t[k * step];
+        const float im = -sin_t[k * step];
+        const float ore = re * odd_fft[2 * k + 0] - im * odd_fft[2 * k + 1];
+        const float oim = re * odd_fft[2 * k + 1] + im * odd_fft[2 * k + 0];
+        out[2 * k + 0] = even_fft[2 * k + 0] + ore;
+        out[2 * k + 1] = even_fft[2 * k + 1] + oim;
+        out[2 * (k + half) + 0] = even_fft[2 * k + 0] - ore;
+        out[2 * (k + half) + 1] = even_fft[2 * k + 1] - oim;
+    }
+}
 
-    std::vector<int> col(len1, 0);
-    std::vector<int> prevCol(len1, 0);
+void log_mel_spectrogram(const float * samples, size_t n_samples, int n_mel, const float * filters, int n_threads, std::vector<float> & mel, int & n_len) {
+    const int n_fft = kMelFftSize / 2 + 1;
+    const size_t pad = kMelFftSize / 2;
+
+    // reflect 200 samples at the start, zeros for 30 s plus 200 samples at the end
+    const size_t n_padded = n_samples + COMMON_SAMPLE_RATE * 30 + 2 * pad;
+    std::vector<float> padded;
+    padded.reserve(n_padded);
+    padded.assign(pad, 0.0f);
+    padded.insert(padded.end(), samples, samples + n_samples);
+    padded.resize(n_padded, 0.0f);
+    for (size_t i = 0; i < pad && i + 1 < n_samples; i++) {
+        padded[pad - 1 - i] = samples[i + 1];
+    }
 
-    for (size_t i = 0; i < len1; i++) {
-        prevCol[i] = i;
+    n_len = int((padded.size() - kMelFftSize) / kMelHopSize);
+    mel.assign(size_t(n_mel) * n_len, 0.0f);
+
+    std::vector<float> cos_t(kMelFftSize);
+    std::vector<float> sin_t(kMelFftSize);
+    std::vector<float> hann(kMelFftSize);
+    for (int i = 0; i < kMelFftSize; i++) {
+        const double theta = 2.0 * M_PI * i / kMelFftSize;
+        cos_t[i] = float(std::cos(theta));
+        sin_t[i] = float(std::sin(theta));
+        hann[i] = float(0.5 * (1.0 - std::cos(theta)));
     }
 
-    for (size_t i = 0; i < len0; i++) {
-        col[0] = i;
-        for (size_t j = 1; j < len1; j++) {
-            col[j] = std::min(std::min(1 + col[j - 1], 1 + prevCol[j]), prevCol[j - 1] + (i > 0 && s0[i - 1] == s1[j - 1] ? 0 : 1));
+    auto worker = [&](int ith, int nth) {
+        std::vector<float> frame(kMelFftSize);
+        std::vector<float> fft_out(2 * kMelFftSize);
+        std::vector<float> scratch(6 * kMelFftSize);
+        std::vector<float> power(n_fft);
+        for (int i = ith; i < n_len; i += nth) {
+            const float * src = padded.data() + size_t(i) * kMelHopSize;
+            for (int j = 0; j < kMelFftSize; j++) {
+                frame[j] = hann[j] * src[j];
+            }
+            mel_fft(frame.data(), kMelFftSize, fft_out.data(), scratch.data(), cos_t.data(), sin_t.data());
+            for (int k = 0; k < n_fft; k++) {
+                power[k] = fft_out[2 * k + 0] * fft_out[2 * k + 0] + fft_out[2 * k + 1] * fft_out[2 * k + 1];
+            }
+            for (int m = 0; m < n_mel; m++) {
+                const float * filter = filters + size_t(m) * n_fft;
+                double sum = 0.0;
+                for (int k = 0; k < n_fft; k++) {
+                    sum += power[k] * filter[k];
+                }
+                mel[size_t(m) * n_len + i] = float(std::log10(std::max(sum, 1e-10)));
+            }
         }
-        col.swap(prevCol);
+    };
+
+    n_threads = std::max(1, n_threads);
+    std::vector<std::thread> workers;
+    for (int t = 1; t < n_threads; t++) {
+        workers.emplace_back(worker, t, n_threads);
+    }
+    worker(0, n_threads);
+    for (auto & w : workers) {
+        w.join();
     }
 
-    const float dist = prevCol[len1 - 1];
+    const float mmax = *std::max_element(mel.begin(), mel.end()) - 8.0f;
+    for (auto & v : mel) {
+        v = (std::max(v, mmax) + 4.0f) / 4.0f;
+    }
+}
+
+// UTF-8 to code points, bytes that are not valid UTF-8 map to U+DC80..U+DCFF so they still compare
+static void utf8_to_code_points(const std::string & s, std::vector<uint32_t> & out) {
+    out.clear();
+    const unsigned char * p = reinterpret_cast<const unsigned char *>(s.data());
+    const size_t n = s.size();
+    for (size_t i = 0; i < n;) {
+        const uint32_t c = p[i];
+        int len = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 0;
+        if (len == 0 || i + len > n) {
+            out.push_back(0xDC00 | c);
+            i++;
+            continue;
+        }
+        uint32_t cp = len == 1 ? c : c & (0x7F >> len);
+        bool valid = true;
+        for (int k = 1; k < len; k++) {
+            if ((p[i + k] & 0xC0) != 0x80) {
+                valid = false;
+                break;
+            }
+            cp = (cp << 6) | (p[i + k] & 0x3F);
+        }
+        if (!valid) {
+            out.push_back(0xDC00 | c);
+            i++;
+            continue;
+        }
+        out.push_back(cp);
+        i += len;
+    }
+}
+
+namespace {
+
+// Myers' bit-vector edit distance, with Hyyrö's multi-word blocks for patterns over 64 code points.
+// All buffers are kept per thread, after warm-up a call does not touch the heap.
+struct edit_distance_engine {
+    std::vector<uint32_t> a;        // pattern, the shorter string
+    std::vector<uint32_t> b;        // text
+    std::vector<uint64_t> peq;      // match masks, [symbol][block]
+    std::vector<uint64_t> pv;
+    std::vector<uint64_t> mv;
+    std::vector<uint32_t> keys;     // open addressing table for symbols outside ASCII
+    std::vector<int>      slots;
+    int ascii[128];
+
+    int symbol(uint32_t c) const {
+        if (c < 128) {
+            return ascii[c];
+        }
+        const size_t mask = keys.size() - 1;
+        for (size_t h = (c * 0x9E3779B1u) & mask;; h = (h + 1) & mask) {
+            if (keys[h] == c) {
+                return slots[h];
+            }
+            if (keys[h] == UINT32_MAX) {
+                return -1;
+            }
+        }
+    }
+
+    int add_symbol(uint32_t c, int next) {
+        if (c < 128) {
+            if (ascii[c] < 0) {
+                ascii[c] = next;
+            }
+            return ascii[c];
+        }
+        const size_t mask = keys.size() - 1;
+        for (size_t h = (c * 0x9E3779B1u) & mask;; h = (h + 1) & mask) {
+            if (keys[h] == c) {
+                return slots[h];
+            }
+            if (keys[h] == UINT32_MAX) {
+                keys[h] = c;
+                slots[h] = next;
+                return next;
+            }
+        }
+    }
+
+    // distance between a and b, or any value above max_dist once it is certain to exceed it
+    int distance(int max_dist) {
+        const int m = int(a.size());
+        const int n = int(b.size());
+        if (m == 0) {
+            return n;
+        }
+
+        const int blocks = (m + 63) / 64;
+        std::fill(ascii, ascii + 128, -1);
+        size_t table = 16;
+        while (table < size_t(2 * m)) {
+            table <<= 1;
+        }
+        keys.assign(table, UINT32_MAX);
+        slots.resize(table);
+
+        // at most m distinct symbols
+        peq.assign(size_t(m) * blocks, 0);
+        int symbols = 0;
+        for (int i = 0; i < m; i++) {
+            const int s = add_symbol(a[i], symbols);
+            if (s == symbols) {
+                symbols++;
+            }
+            peq[size_t(s) * blocks + i / 64] |= uint64_t(1) << (i % 64);
+        }
+
+        pv.assign(blocks, ~uint64_t(0));
+        mv.assign(blocks, 0);
+        const uint64_t last = uint64_t(1) << ((m - 1) % 64);
+        const uint64_t high = uint64_t(1) << 63;
+
+        int score = m;
+        for (int j = 0; j < n; j++) {
+            const int s = symbol(b[j]);
+            const uint64_t * eqs = s >= 0 ? &peq[size_t(s) * blocks] : nullptr;
+
+            int hin = 1; // top row of the global distance grows by one per column
+            for (int k = 0; k < blocks; k++) {
+                uint64_t eq = eqs ? eqs[k] : 0;
+                const uint64_t p = pv[k];
+                const uint64_t mm = mv[k];
+                const uint64_t out_bit = k == blocks - 1 ? last : high;
+
+                const uint64_t xv = eq | mm;
+                if (hin < 0) {
+                    eq |= 1;
+                }
+                const uint64_t xh = (((eq & p) + p) ^ p) | eq;
+                uint64_t ph = mm | ~(xh | p);
+                uint64_t mh = p & xh;
+
+                const int hout = (ph & out_bit) ? 1 : (mh & out_bit) ? -1 : 0;
+
+                ph <<= 1;
+                mh <<= 1;
+                if (hin < 0) {
+                    mh |= 1;
+                } else if (hin > 0) {
+                    ph |= 1;
+                }
+                pv[k] = mh | ~(xv | ph);
+                mv[k] = ph & xv;
+                hin = hout;
+            }
+            score += hin;
+
+            // every remaining column lowers the last row by at most one
+            if (score - (n - 1 - j) > max_dist) {
+                return max_dist + 1;
+            }
+        }
+        return score;
+    }
+};
+
+}
+
+int edit_distance(const std::vector<uint32_t> & s0, const std::vector<uint32_t> & s1) {
+    thread_local edit_distance_engine engine;
+    const bool swap = s0.size() > s1.size();
+    engine.a.assign((swap ? s1 : s0).begin(), (swap ? s1 : s0).end());
+    engine.b.assign((swap ? s0 : s1).begin(), (swap ? s0 : s1).end());
+    return engine.distance(int(engine.b.size()));
+}
+
+float similarity(const std::string & s0, const std::string & s1, float min_similarity) {
+    if (s0 == s1) {
+        return 1.0f;
+    }
+
+    thread_local edit_distance_engine engine;
+    utf8_to_code_points(s0.size() <= s1.size() ? s0 : s1, engine.a);
+    utf8_to_code_points(s0.size() <= s1.size() ? s1 : s0, engine.b);
+    if (engine.a.size() > engine.b.size()) {
+        engine.a.swap(engine.b);
+    }
+
+    const int len = int(engine.b.size());
+    if (len == 0) {
+        return 1.0f;
+    }
+
+    // band: the length difference alone may already rule the pair out
+    // largest distance that still scores min_similarity, in the same float arithmetic as the result
+    int max_dist = len;
+    if (min_similarity > 0.0f) {
+        max_dist = int((1.0f - min_similarity) * len);
+        while (max_dist < len && 1.0f - float(max_dist + 1) / len >= min_similarity) {
+            max_dist++;
+        }
+        while (max_dist > 0 && 1.0f - float(max_dist) / len < min_similarity) {
+            max_dist--;
+        }
+    }
+    if (int(engine.b.size() - engine.a.size()) > max_dist) {
+        return 1.0f - float(engine.b.size() - engine.a.size()) / len;
+    }
 
-    return 1.0f - (dist / std::max(s0.size(), s1.size()));
+    const int dist = engine.distance(max_dist);
+    return 1.0f - float(std::min(dist, len)) / len;
 }
 
 bool sam_params_parse(int argc, char ** argv, sam_params & params) {
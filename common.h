@@ -140,7 +140,8 @@ bool is_wav_buffer(const std::string buf);
 
 // Read WAV audio file and store the PCM data into pcmf32
 // fname can be a buffer of WAV data instead of a filename
-// The sample rate of the audio must be equal to COMMON_SAMPLE_RATE
+// Any sample rate, integer or float sample format and channel count is accepted:
+// the audio is downmixed to mono and resampled to COMMON_SAMPLE_RATE in-process
 // If stereo flag is set and the audio has 2 channels, the pcmf32s will contain 2 channel PCM
 bool read_wav(
         const std::string & fname,
@@ -148,6 +149,32 @@ bool read_wav(
         std::vector<std::vector<float>> & pcmf32s,
         bool stereo);
 
+// Polyphase windowed-sinc resampler for a fixed rational ratio, 85 dB of stopband attenuation
+// from the lower Nyquist frequency on; the filter length follows from the ratio
+// Input can be fed in blocks of any size, output is appended to the given vector
+class polyphase_resampler {
+public:
+    polyphase_resampler(int rate_in, int rate_out);
+
+    void process(const float * in, size_t n, std::vector<float> & out);
+
+    // push out the samples still held back by the filter delay
+    void flush(std::vector<float> & out);
+
+private:
+    void drain(std::vector<float> & out);
+
+    int up;   // interpolation factor L
+    int down; // decimation factor M
+    int taps;
+
+    std::vector<float> coeffs; // one reversed, contiguous row of taps per phase
+    std::vector<float> buf;    // input history plus pending samples
+    uint64_t next = 0;         // position of the next output, in upsampled units relative to buf
+    uint64_t n_in  = 0;
+    uint64_t n_out = 0;
+};
+
 // Write PCM data into WAV audio file
 class wav_writer {
 private:
@@ -262,8 +289,27 @@ bool vad_simple(
         float freq_thold,
         bool  verbose);
 
-// compute similarity between two strings using Levenshtein distance
-float similarity(const std::string & s0, const std::string & s1);
+// Log-mel spectrogram computed the way whisper.cpp does it: 25 ms periodic Hann window,
+// 10 ms hop, 30 s of trailing zero padding, log10 clamped to 8 below the maximum and
+// scaled by (x + 4) / 4. whisper.cpp has no call that hands its own mel back, so the mel
+// cache computes it here, always with the [n_mel][201] filterbank stored in the model.
+// mel is laid out as [n_mel][n_len], ready for whisper_set_mel
+void log_mel_spectrogram(
+        const float * samples,
+        size_t n_samples,
+        int n_mel,
+        const float * filters,
+        int n_threads,
+        std::vector<float> & mel,
+        int & n_len);
+
+// Levenshtein distance between two symbol sequences: code points, word ids, ...
+int edit_distance(const std::vector<uint32_t> & s0, const std::vector<uint32_t> & s1);
+
+// compute similarity between two strings using Levenshtein distance over code points
+// 1 - distance / length of the longer string; below min_similarity the result is only
+// guaranteed to stay below it, which lets dissimilar pairs exit early
+float similarity(const std::string & s0, const std::string & s1, float min_similarity = 0.0f);
 
 //
 // SAM argument parsing
@@ -0,0 +1,339 @@
+#include "coordinator.h"
+#include "workerprotocol.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QTcpSocket>
+#include <QDebug>
+
+#include <cstdio>
+
+Coordinator::Coordinator(const whisper_params &params, QObject *parent)
+    : QObject(parent), params(params) {
+    clock.start();
+    connect(&server, &QTcpServer::newConnection, this, &Coordinator::onNewConnection);
+    connect(&tick, &QTimer::timeout, this, &Coordinator::onTick);
+    tick.start(1000);
+}
+
+bool Coordinator::listen(const QHostAddress &address, quint16 port) {
+    if (!server.listen(address, port)) {
+        qWarning() << "coordinator: cannot listen on port" << port << server.errorString();
+        return false;
+    }
+    qInfo() << "coordinator: listening on" << server.serverAddress().toString() << server.serverPort();
+    if (!address.isLoopback() && token.isEmpty()) {
+        qWarning("coordinator: reachable from other machines without --token, anyone there can queue jobs");
+    }
+    return true;
+}
+
+void Coordinator::setToken(const QString &token) {
+    this->token = token;
+}
+
+qint64 Coordinator::add(const QString &file, const QString &outputFolder) {
+    Job job;
+    job.id = ++lastId;
+    job.file = QFileInfo(file).absoluteFilePath();
+    job.outputFolder = outputFolder.isEmpty() ? QFileInfo(job.file).absolutePath() : outputFolder;
+    job.queuedMs = clock.elapsed();
+    jobs.append(job);
+    qInfo() << "coordinator: queued" << job.id << job.file;
+    schedule();
+    return job.id;
+}
+
+void Coordinator::setExitWhenDone(bool enabled) {
+    exitWhenDone = enabled;
+}
+
+void Coordinator::onNewConnection() {
+    while (QTcpSocket *socket = server.nextPendingConnection()) {
+        Node *node = new Node;
+        node->socket = socket;
+        node->lastSeenMs = clock.elapsed();
+        nodes.append(node);
+        connect(socket, &QTcpSocket::readyRead, this, [this, node]() { onReadyRead(node); });
+        connect(socket, &QTcpSocket::disconnected, this, [this, node]() { dropNode(node, "disconnected"); });
+    }
+}
+
+void Coordinator::onReadyRead(Node *node) {
+    node->buffer.append(node->socket->readAll());
+    QJsonObject message;
+    while (WorkerProtocol::next(node->buffer, message)) {
+        onMessage(node, message);
+        if (!nodes.contains(node)) {
+            return;
+        }
+    }
+}
+
+void Coordinator::onMessage(Node *node, const QJsonObject &message) {
+    const QString type = message["type"].toString();
+    if ((type == "register" || type == "submit") && message["token"].toString() != token) {
+        qWarning() << "coordinator: rejected" << type << "from" << node->socket->peerAddress().toString() << "with a wrong token";
+        dropNode(node, "wrong token");
+        return;
+    }
+    if (node->capacity == 0 && type != "register" && type != "submit") {
+        return;
+    }
+    node->lastSeenMs = clock.elapsed();
+
+    if (type == "register") {
+        node->name = message["name"].toString();
+        node->capacity = qMax(1, message["slots"].toInt());
+        node->roots.clear();
+        for (const auto &root : message["roots"].toArray()) {
+            node->roots.append(QDir::cleanPath(root.toString()));
+        }
+        qInfo() << "coordinator: node" << node->name << "with" << node->capacity << "slot(s), local" << node->roots;
+        QJsonObject reply;
+        reply["type"] = "registered";
+        reply["heartbeatMs"] = kHeartbeatMs;
+        send(node->socket, reply);
+        schedule();
+    } else if (type == "heartbeat") {
+        // renews the lease of every job the node still holds
+        for (const auto &value : message["jobs"].toArray()) {
+            const QJsonObject held = value.toObject();
+            Job *job = findJob(qint64(held["id"].toDouble()));
+            if (job && job->state == Running && job->node == node && job->lease == qint64(held["lease"].toDouble())) {
+                job->leaseExpiresMs = clock.elapsed() + kLeaseMs;
+                job->progress = held["progress"].toInt();
+            }
+        }
+    } else if (type == "finished") {
+        Job *job = findJob(qint64(message["id"].toDouble()));
+        if (!job || job->state != Running || job->node != node || job->lease != qint64(message["lease"].toDouble())) {
+            qInfo() << "coordinator: ignoring stale result for job" << message["id"].toDouble() << "from" << node->name;
+            return;
+        }
+        finish(*job, message["ok"].toBool(), message["error"].toString());
+        schedule();
+        checkDone();
+    } else if (type == "submit") {
+        // any client may add to the queue, not only nodes
+        QJsonArray ids;
+        for (const auto &file : message["files"].toArray()) {
+            ids.append(add(file.toString(), message["output"].toString()));
+        }
+        QJsonObject reply;
+        reply["type"] = "accepted";
+        reply["ids"] = ids;
+        send(node->socket, reply);
+    }
+}
+
+void Coordinator::onTick() {
+    const qint64 now = clock.elapsed();
+    for (auto *node : QList<Node *>(nodes)) {
+        if (node->capacity > 0 && now - node->lastSeenMs > kNodeTimeoutMs) {
+            dropNode(node, "missed heartbeats");
+        }
+    }
+    // a node can be alive and still have lost a job, its heartbeats stop listing it
+    for (auto &job : jobs) {
+        if (job.state == Running && now > job.leaseExpiresMs) {
+            QJsonObject cancel;
+            cancel["type"] = "cancel";
+            cancel["id"] = job.id;
+            send(job.node->socket, cancel);
+            requeue(job, "lease expired");
+        }
+    }
+    schedule();
+    checkDone();
+}
+
+void Coordinator::dropNode(Node *node, const QString &reason) {
+    if (!nodes.removeOne(node)) {
+        return;
+    }
+    if (node->capacity > 0) {
+        qWarning() << "coordinator: lost node" << node->name << reason;
+    }
+    for (auto &job : jobs) {
+        if (job.state == Running && job.node == node) {
+            requeue(job, "node " + node->name + " " + reason);
+        }
+    }
+    node->socket->disconnect(this);
+    node->socket->abort();
+    node->socket->deleteLater();
+    delete node;
+    schedule();
+    checkDone();
+}
+
+void Coordinator::requeue(Job &job, const QString &reason) {
+    job.node = nullptr;
+    job.lease = 0;
+    job.progress = 0;
+    if (job.attempts >= kMaxAttempts) {
+        finish(job, false, reason);
+        return;
+    }
+    qInfo() << "coordinator: requeued job" << job.id << reason;
+    job.state = Queued;
+    job.queuedMs = clock.elapsed();
+}
+
+void Coordinator::finish(Job &job, bool ok, const QString &error) {
+    job.state = ok ? Done : Failed;
+    job.error = ok ? QString() : error;
+    job.progress = ok ? 100 : job.progress;
+
+    // one JSON line per job on stdout, the log goes to stderr
+    QJsonObject result;
+    result["id"] = job.id;
+    result["file"] = job.file;
+    result["node"] = job.node ? job.node->name : QString();
+    result["attempts"] = job.attempts;
+    result["ok"] = ok;
+    if (!ok) {
+        result["error"] = job.error;
+    }
+    printf("%s\n", QJsonDocument(result).toJson(QJsonDocument::Compact).constData());
+    fflush(stdout);
+
+    job.node = nullptr;
+    job.lease = 0;
+}
+
+void Coordinator::schedule() {
+    const qint64 now = clock.elapsed();
+    for (auto &job : jobs) {
+        if (job.state != Queued) {
+            continue;
+        }
+        Node *best = nullptr;
+        Node *bestLocal = nullptr;
+        bool localExists = false;
+        for (auto *node : nodes) {
+            if (node->capacity == 0) {
+                continue;
+            }
+            const bool local = isLocal(node, job.file);
+            localExists = localExists || local;
+            const int free = node->capacity - running(node);
+            if (free <= 0) {
+                continue;
+            }
+            // the least loaded node, relative to its size
+            if (!best || free * best->capacity > (best->capacity - running(best)) * node->capacity) {
+                best = node;
+            }
+            if (local && (!bestLocal || free > bestLocal->capacity - running(bestLocal))) {
+                bestLocal = node;
+            }
+        }
+        if (bestLocal) {
+            assign(job, bestLocal);
+        } else if (best && (!localExists || now - job.queuedMs > kLocalityWaitMs)) {
+            // holding out for the node with the file has a limit, an idle remote node wins eventually
+            assign(job, best);
+        }
+    }
+}
+
+void Coordinator::assign(Job &job, Node *node) {
+    job.state = Running;
+    job.node = node;
+    job.lease = ++lastLease;
+    job.leaseExpiresMs = clock.elapsed() + kLeaseMs;
+    job.attempts++;
+
+    QJsonObject message;
+    message["type"] = "job";
+    message["id"] = job.id;
+    message["lease"] = job.lease;
+    message["file"] = job.file;
+    message["output"] = job.outputFolder;
+    message["params"] = WorkerProtocol::toJson(params);
+    send(node->socket, message);
+    qInfo() << "coordinator: job" << job.id << "to" << node->name << (isLocal(node, job.file) ? "(local)" : "") << "attempt" << job.attempts;
+}
+
+int Coordinator::running(const Node *node) const {
+    int count = 0;
+    for (const auto &job : jobs) {
+        if (job.state == Running && job.node == node) {
+            count++;
+        }
+    }
+    return count;
+}
+
+bool Coordinator::isLocal(const Node *node, const QString &file) const {
+    for (const auto &root : node->roots) {
+        if (file.startsWith(root + "/")) {
+            return true;
+        }
+    }
+    return false;
+}
+
+Coordinator::Job *Coordinator::findJob(qint64 id) {
+    for (auto &job : jobs) {
+        if (job.id == id) {
+            return &job;
+        }
+    }
+    return nullptr;
+}
+
+void Coordinator::send(QTcpSocket *socket, const QJsonObject &message) {
+    socket->write(WorkerProtocol::frame(message));
+}
+
+void Coordinator::checkDone() {
+    if (!exitWhenDone || jobs.isEmpty()) {
+        return;
+    }
+    int failed = 0;
+    for (const auto &job : jobs) {
+        if (job.state == Queued || job.state == Running) {
+            return;
+        }
+        failed += job.state == Failed ? 1 : 0;
+    }
+    qInfo("coordinator: %d job(s) done, %d failed", int(jobs.size()) - failed, failed);
+    QCoreApplication::exit(failed > 0 ? 1 : 0);
+}
+
+int Coordinator::submit(const QString &host, quint16 port, const QStringList &files, const QString &outputFolder, const QString &token) {
+    QTcpSocket socket;
+    socket.connectToHost(host, port);
+    if (!socket.waitForConnected(5000)) {
+        qWarning() << "submit: cannot reach" << host << port << socket.errorString();
+        return 1;
+    }
+    QJsonObject message;
+    message["type"] = "submit";
+    message["token"] = token;
+    QJsonArray paths;
+    for (const auto &file : files) {
+        paths.append(QFileInfo(file).absoluteFilePath());
+    }
+    message["files"] = paths;
+    message["output"] = outputFolder.isEmpty() ? QString() : QFileInfo(outputFolder).absoluteFilePath();
+    socket.write(WorkerProtocol::frame(message));
+
+    QByteArray buffer;
+    QJsonObject reply;
+    while (socket.waitForReadyRead(10000)) {
+        buffer.append(socket.readAll());
+        if (WorkerProtocol::next(buffer, reply)) {
+            printf("%s\n", QJsonDocument(reply["ids"].toArray()).toJson(QJsonDocument::Compact).constData());
+            return 0;
+        }
+    }
+    qWarning() << "submit: no reply from the coordinator";
+    return 1;
+}
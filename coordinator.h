@@ -0,0 +1,102 @@
+#ifndef COORDINATOR_H
+#define COORDINATOR_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QHostAddress>
+#include <QJsonObject>
+#include <QList>
+#include <QObject>
+#include <QStringList>
+#include <QTcpServer>
+#include <QTimer>
+#include "transcriber.h"
+
+class QTcpSocket;
+
+// Keeps one queue for several transcription machines (--coordinator). Nodes (--node) register
+// over TCP with their slot count and the directories they hold locally, then get jobs as slots
+// free up. Every assignment is a lease renewed by the node's heartbeats: a node that goes
+// silent or disconnects loses its jobs to the queue again, and a late result for an expired
+// lease is ignored. Jobs wait briefly for a node that has their file on local disk before
+// going to any free node. Messages use the worker framing (WorkerProtocol).
+class Coordinator : public QObject {
+    Q_OBJECT
+
+public:
+    explicit Coordinator(const whisper_params &params, QObject *parent = nullptr);
+
+    bool listen(const QHostAddress &address, quint16 port);
+
+    // nodes and submitters have to present it, connections without it are dropped
+    void setToken(const QString &token);
+
+    // an empty output folder writes next to the file; returns the job id
+    qint64 add(const QString &file, const QString &outputFolder);
+
+    // quit the event loop once every job has finished, exit code 1 if any failed
+    void setExitWhenDone(bool enabled);
+
+    // sends files to a running coordinator and returns a process exit code
+    static int submit(const QString &host, quint16 port, const QStringList &files, const QString &outputFolder, const QString &token = QString());
+
+    static const int kHeartbeatMs = 2000;
+    static const int kNodeTimeoutMs = 3 * kHeartbeatMs;
+    static const int kLeaseMs = 15000;
+    static const int kLocalityWaitMs = 5000;
+    static const int kMaxAttempts = 3;
+
+private:
+    enum State { Queued, Running, Done, Failed };
+
+    struct Node {
+        QTcpSocket *socket = nullptr;
+        QString name;
+        int capacity = 0;           // concurrent jobs, 0 until registered
+        QStringList roots;          // absolute directories on the node's local disk
+        QByteArray buffer;
+        qint64 lastSeenMs = 0;
+    };
+
+    struct Job {
+        qint64 id = 0;
+        QString file;
+        QString outputFolder;
+        State state = Queued;
+        int attempts = 0;
+        qint64 lease = 0;           // current assignment, results for older ones are stale
+        Node *node = nullptr;
+        qint64 leaseExpiresMs = 0;
+        qint64 queuedMs = 0;
+        int progress = 0;
+        QString error;
+    };
+
+    void onNewConnection();
+    void onReadyRead(Node *node);
+    void onMessage(Node *node, const QJsonObject &message);
+    void onTick();
+    void dropNode(Node *node, const QString &reason);
+    void requeue(Job &job, const QString &reason);
+    void finish(Job &job, bool ok, const QString &error);
+    void schedule();
+    void assign(Job &job, Node *node);
+    int running(const Node *node) const;
+    bool isLocal(const Node *node, const QString &file) const;
+    Job *findJob(qint64 id);
+    void send(QTcpSocket *socket, const QJsonObject &message);
+    void checkDone();
+
+    QTcpServer server;
+    QList<Node *> nodes;
+    QList<Job> jobs;
+    whisper_params params;
+    QElapsedTimer clock;
+    QTimer tick;
+    qint64 lastId = 0;
+    qint64 lastLease = 0;
+    bool exitWhenDone = false;
+    QString token;
+};
+
+#endif // COORDINATOR_H
@@ -0,0 +1,267 @@
+#include "dualdecoder.h"
+
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+
+// mel frames per encoder window and per timestamp token
+static const int kWindowFrames = 3000;
+static const int kFramesPerTimestamp = 2;
+// the first timestamp of a window, as in whisper_full: at most 1 s in
+static const int kMaxInitialTimestamp = 50;
+
+DualDecoder::DualDecoder(struct whisper_context *ctx, struct whisper_state *state, const whisper_params &params)
+    : ctx(ctx), state(state), params(params) {}
+
+bool DualDecoder::run(const std::vector<float> &pcmf32, const std::atomic<bool> *abortFlag, const std::function<void(int)> &progress) {
+    segments[0].clear();
+    segments[1].clear();
+
+    if (!whisper_is_multilingual(ctx)) {
+        qWarning("dual decoder: %s is English-only and cannot translate", params.model.c_str());
+        return false;
+    }
+    if (whisper_pcm_to_mel_with_state(ctx, state, pcmf32.data(), int(pcmf32.size()), params.n_threads) != 0) {
+        return false;
+    }
+
+    const int n_len = whisper_n_len_from_state(state);
+    int seek = std::max(0, params.offset_t_ms / 10);
+    const int seekEnd = params.duration_ms > 0 ? std::min(n_len, seek + params.duration_ms / 10) : n_len;
+
+    if (params.language == "auto") {
+        langId = whisper_lang_auto_detect_with_state(ctx, state, seek * 10, params.n_threads, nullptr);
+    } else {
+        langId = whisper_lang_id(params.language.c_str());
+    }
+    if (langId < 0) {
+        return false;
+    }
+
+    // prompt history per task, seeded with the initial prompt
+    std::vector<whisper_token> past[2];
+    if (!params.prompt.empty()) {
+        std::vector<whisper_token> prompt(whisper_model_n_text_ctx(ctx));
+        const int n = whisper_tokenize(ctx, params.prompt.c_str(), prompt.data(), int(prompt.size()));
+        if (n > 0) {
+            prompt.resize(n);
+            past[0] = prompt;
+            past[1] = prompt;
+        }
+    }
+
+    while (seek + 100 < seekEnd) {
+        if (abortFlag && abortFlag->load()) {
+            return false;
+        }
+
+        const int windowFrames = std::min(kWindowFrames, seekEnd - seek);
+        // the one encoder pass both decoders share
+        if (whisper_encode_with_state(ctx, state, seek, params.n_threads) != 0) {
+            return false;
+        }
+
+        const Pass transcribed = decode(false, past[0], windowFrames / kFramesPerTimestamp);
+        const int cut = cutOf(transcribed, windowFrames);
+        collect(transcribed, 0, seek, cut, past[0]);
+
+        // the whole window too: capped at the cut it could stop short and leave audio untranslated;
+        // a segment running over the cut is kept, the next window starts at the cut
+        const Pass translated = decode(true, past[1], windowFrames / kFramesPerTimestamp);
+        collect(translated, 1, seek, cut, past[1]);
+
+        seek += cut;
+        if (progress) {
+            progress(int(int64_t(seek) * 100 / seekEnd));
+        }
+    }
+    return true;
+}
+
+DualDecoder::Pass DualDecoder::decode(bool translate, const std::vector<whisper_token> &past, int maxTimestamp) {
+    const int n_text_ctx = whisper_model_n_text_ctx(ctx);
+
+    std::vector<whisper_token> prompt;
+    if (!past.empty() && !params.no_context) {
+        const int n_past = std::min(int(past.size()), n_text_ctx / 2 - 1);
+        prompt.push_back(whisper_token_prev(ctx));
+        prompt.insert(prompt.end(), past.end() - n_past, past.end());
+    }
+    prompt.push_back(whisper_token_sot(ctx));
+    prompt.push_back(whisper_token_lang(ctx, langId));
+    prompt.push_back(translate ? whisper_token_translate(ctx) : whisper_token_transcribe(ctx));
+
+    // the last prompt token goes alone, so the logits read afterwards are always
+    // those of a single-token batch whatever whisper keeps for longer batches
+    Pass pass;
+    const int n_prompt = int(prompt.size());
+    if (whisper_decode_with_state(ctx, state, prompt.data(), n_prompt - 1, 0, params.n_threads) != 0
+        || whisper_decode_with_state(ctx, state, &prompt.back(), 1, n_prompt - 1, params.n_threads) != 0) {
+        return pass;
+    }
+
+    // room for the prompt and half the context, like whisper_full
+    int n_past = int(prompt.size());
+    const int maxTokens = std::min(n_text_ctx / 2, n_text_ctx - n_past - 1);
+    for (int i = 0; i < maxTokens; ++i) {
+        float p = 0.0f;
+        whisper_token token = sample(pass.tokens, maxTimestamp, p);
+        if (token == whisper_token_eot(ctx)) {
+            break;
+        }
+        pass.tokens.push_back(token);
+        pass.probs.push_back(p);
+        if (whisper_decode_with_state(ctx, state, &token, 1, n_past, params.n_threads) != 0) {
+            break;
+        }
+        n_past++;
+    }
+    return pass;
+}
+
+// greedy choice under whisper's timestamp rules
+whisper_token DualDecoder::sample(const std::vector<whisper_token> &generated, int maxTimestamp, float &p) {
+    const int n_vocab = whisper_n_vocab(ctx);
+    const whisper_token eot = whisper_token_eot(ctx);
+    const whisper_token beg = whisper_token_beg(ctx);
+    const float ninf = -INFINITY;
+
+    const float *stateLogits = whisper_get_logits_from_state(state);
+    logits.assign(stateLogits, stateLogits + n_vocab);
+
+    // no special tokens besides end of text and timestamps
+    for (int id = eot + 1; id < beg; ++id) {
+        logits[id] = ninf;
+    }
+    for (int id = beg + maxTimestamp + 1; id < n_vocab; ++id) {
+        logits[id] = ninf;
+    }
+
+    const bool lastWasTimestamp = !generated.empty() && generated.back() >= beg;
+    const bool penultimateWasTimestamp = generated.size() < 2 || generated[generated.size() - 2] >= beg;
+
+    if (generated.empty()) {
+        // a window starts with a timestamp near its beginning
+        for (int id = 0; id < beg; ++id) {
+            logits[id] = ninf;
+        }
+        for (int id = beg + kMaxInitialTimestamp + 1; id < n_vocab; ++id) {
+            logits[id] = ninf;
+        }
+    } else {
+        if (lastWasTimestamp && penultimateWasTimestamp) {
+            for (int id = beg; id < n_vocab; ++id) {
+                logits[id] = ninf;
+            }
+        } else if (lastWasTimestamp) {
+            for (int id = 0; id < eot; ++id) {
+                logits[id] = ninf;
+            }
+        }
+
+        // timestamps never go backwards
+        for (auto it = generated.rbegin(); it != generated.rend(); ++it) {
+            if (*it >= beg) {
+                const whisper_token first = lastWasTimestamp ? *it : *it + 1;
+                for (int id = beg; id < first; ++id) {
+                    logits[id] = ninf;
+                }
+                break;
+            }
+        }
+    }
+
+    // log-softmax, then prefer a timestamp when all of them together beat any text token
+    const float maxLogit = *std::max_element(logits.begin(), logits.end());
+    double sum = 0.0;
+    for (float l : logits) {
+        sum += std::exp(double(l - maxLogit));
+    }
+    const float logSum = maxLogit + float(std::log(sum));
+
+    double timestampSum = 0.0;
+    for (int id = beg; id < n_vocab; ++id) {
+        timestampSum += std::exp(double(logits[id] - maxLogit));
+    }
+    const float timestampLogprob = timestampSum > 0.0 ? maxLogit + float(std::log(timestampSum)) - logSum : ninf;
+    const float textLogprob = *std::max_element(logits.begin(), logits.begin() + beg) - logSum;
+    if (timestampLogprob > textLogprob) {
+        for (int id = 0; id < beg; ++id) {
+            logits[id] = ninf;
+        }
+    }
+
+    const whisper_token best = whisper_token(std::max_element(logits.begin(), logits.end()) - logits.begin());
+    p = std::exp(logits[best] - logSum);
+    return best;
+}
+
+// frames of the window the transcription accounts for
+int DualDecoder::cutOf(const Pass &pass, int windowFrames) const {
+    const whisper_token beg = whisper_token_beg(ctx);
+    if (pass.tokens.empty() || pass.tokens.back() >= beg) {
+        return windowFrames; // every segment closed
+    }
+
+    // ended inside a segment: resume at the last closing timestamp, if there is one
+    for (size_t i = pass.tokens.size(); i-- > 1;) {
+        if (pass.tokens[i] >= beg && pass.tokens[i - 1] < beg) {
+            return std::max(1, int(pass.tokens[i] - beg) * kFramesPerTimestamp);
+        }
+    }
+    return windowFrames;
+}
+
+void DualDecoder::collect(const Pass &pass, int task, int seek, int cut, std::vector<whisper_token> &past) {
+    const whisper_token beg = whisper_token_beg(ctx);
+    const int64_t windowEnd = seek + cut;
+
+    // segments past the cut are decoded again with the next window
+    auto keep = [&](transcript_segment &segment, int64_t t0, int64_t t1) {
+        if (t0 >= windowEnd) {
+            return;
+        }
+        segment.t0 = t0;
+        segment.t1 = std::min(t1, windowEnd);
+        for (const auto &token : segment.tokens) {
+            past.push_back(token.id);
+        }
+        segments[task].push_back(segment);
+    };
+
+    transcript_segment segment;
+    int64_t start = seek;
+    bool open = false;
+    for (size_t i = 0; i < pass.tokens.size(); ++i) {
+        const whisper_token token = pass.tokens[i];
+        if (token >= beg) {
+            const int64_t t = seek + int64_t(token - beg) * kFramesPerTimestamp;
+            if (open) {
+                keep(segment, start, t);
+                segment = transcript_segment();
+                open = false;
+            }
+            start = t;
+            continue;
+        }
+
+        transcript_token data;
+        data.id = token;
+        data.text = whisper_token_to_str(ctx, token);
+        data.p = pass.probs[i];
+        segment.text += data.text;
+        segment.tokens.push_back(data);
+        open = true;
+    }
+
+    // text left open at the end runs to the cut, unless the cut is before it
+    if (open) {
+        keep(segment, start, windowEnd);
+    }
+
+    const size_t maxPast = size_t(whisper_model_n_text_ctx(ctx));
+    if (past.size() > maxPast) {
+        past.erase(past.begin(), past.end() - maxPast);
+    }
+}
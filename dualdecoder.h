@@ -0,0 +1,44 @@
+#ifndef DUALDECODER_H
+#define DUALDECODER_H
+
+#include <atomic>
+#include <functional>
+#include <vector>
+#include "transcriber.h"
+
+// Transcribes and translates the same audio while running the encoder once per
+// 30 s window: both greedy decoder passes read the same cross-attention cache.
+// The transcription decides where each window ends; the translation decodes the
+// whole window and keeps the segments that start before that cut, so both
+// advance together without leaving audio untranslated.
+class DualDecoder {
+public:
+    DualDecoder(struct whisper_context *ctx, struct whisper_state *state, const whisper_params &params);
+
+    // false when the model cannot translate, the audio is too short or decoding was aborted
+    bool run(const std::vector<float> &pcmf32, const std::atomic<bool> *abortFlag, const std::function<void(int)> &progress);
+
+    const std::vector<transcript_segment> &transcript() const { return segments[0]; }
+    const std::vector<transcript_segment> &translation() const { return segments[1]; }
+    int languageId() const { return langId; }
+
+private:
+    struct Pass {
+        std::vector<whisper_token> tokens; // sampled tokens, prompt excluded
+        std::vector<float> probs;
+    };
+
+    Pass decode(bool translate, const std::vector<whisper_token> &past, int maxTimestamp);
+    whisper_token sample(const std::vector<whisper_token> &generated, int maxTimestamp, float &p);
+    int cutOf(const Pass &pass, int windowFrames) const;
+    void collect(const Pass &pass, int task, int seek, int cut, std::vector<whisper_token> &past);
+
+    struct whisper_context *ctx;
+    struct whisper_state *state;
+    whisper_params params;
+    int langId = 0;
+    std::vector<transcript_segment> segments[2];
+    std::vector<float> logits;
+};
+
+#endif // DUALDECODER_H
@@ -0,0 +1,214 @@
+#include "hardwareinfo.h"
+
+#include <QDir>
+#include <QFile>
+#include <QMap>
+#include <QPair>
+#include <QSysInfo>
+
+#include <thread>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <sys/sysctl.h>
+#include <mach/mach.h>
+#else
+#include <unistd.h>
+#endif
+
+static QString readSysFile(const QString &path) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+        return QString();
+    }
+    return QString::fromLatin1(file.readAll()).trimmed();
+}
+
+QVector<int> HardwareInfo::parseCpuList(const QString &list) {
+    QVector<int> cpus;
+    const auto ranges = list.split(',', Qt::SkipEmptyParts);
+    for (const auto &range : ranges) {
+        const auto bounds = range.trimmed().split('-');
+        bool ok0 = false;
+        bool ok1 = true;
+        const int first = bounds.value(0).toInt(&ok0);
+        const int last = bounds.size() > 1 ? bounds.value(1).toInt(&ok1) : first;
+        if (!ok0 || !ok1) {
+            continue;
+        }
+        for (int cpu = first; cpu <= last; ++cpu) {
+            cpus.append(cpu);
+        }
+    }
+    return cpus;
+}
+
+CpuTopology HardwareInfo::cpuTopology() {
+    CpuTopology topology;
+    topology.logicalCpus = qMax(1, (int) std::thread::hardware_concurrency());
+    topology.physicalCores = topology.logicalCpus;
+
+#if defined(__linux__)
+    const QString base = "/sys/devices/system/cpu/";
+    QVector<int> online = parseCpuList(readSysFile(base + "online"));
+    if (online.isEmpty()) {
+        for (int cpu = 0; cpu < topology.logicalCpus; ++cpu) {
+            online.append(cpu);
+        }
+    }
+
+    // (package, core) -> logical cpus
+    QMap<QPair<int, int>, QVector<int>> cores;
+    QMap<int, bool> packages;
+    for (int cpu : online) {
+        const QString dir = base + QString("cpu%1/topology/").arg(cpu);
+        bool okCore = false;
+        bool okPackage = false;
+        const int core = readSysFile(dir + "core_id").toInt(&okCore);
+        const int package = readSysFile(dir + "physical_package_id").toInt(&okPackage);
+        if (!okCore || !okPackage) {
+            // no topology information (containers, exotic kernels): one core per cpu
+            cores[qMakePair(0, 100000 + cpu)].append(cpu);
+            packages[0] = true;
+            continue;
+        }
+        cores[qMakePair(package, core)].append(cpu);
+        packages[package] = true;
+    }
+
+    topology.logicalCpus = online.size();
+    topology.physicalCores = cores.size();
+    topology.packages = qMax(1, packages.size());
+    for (const auto &siblings : cores) {
+        topology.cores.append(siblings);
+    }
+
+    const QStringList nodeDirs = QDir("/sys/devices/system/node/").entryList(QStringList() << "node*", QDir::Dirs);
+    for (const auto &nodeDir : nodeDirs) {
+        bool ok = false;
+        const int node = nodeDir.mid(4).toInt(&ok);
+        if (!ok) {
+            continue;
+        }
+        QVector<int> cpus;
+        for (int cpu : parseCpuList(readSysFile(QString("/sys/devices/system/node/node%1/cpulist").arg(node)))) {
+            if (online.contains(cpu)) {
+                cpus.append(cpu);
+            }
+        }
+        if (topology.nodes.size() <= node) {
+            topology.nodes.resize(node + 1);
+        }
+        topology.nodes[node] = cpus;
+    }
+#elif defined(_WIN32)
+    DWORD length = 0;
+    GetLogicalProcessorInformationEx(RelationAll, nullptr, &length);
+    QByteArray buffer(int(length), 0);
+    auto *info = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data());
+    if (length > 0 && GetLogicalProcessorInformationEx(RelationAll, info, &length)) {
+        int packages = 0;
+        int logical = 0;
+        for (DWORD offset = 0; offset < length;) {
+            auto *item = reinterpret_cast<SYSTEM_LOGICAL_PROCESSOR_INFORMATION_EX *>(buffer.data() + offset);
+            if (item->Relationship == RelationProcessorCore) {
+                QVector<int> siblings;
+                for (WORD g = 0; g < item->Processor.GroupCount; ++g) {
+                    const KAFFINITY mask = item->Processor.GroupMask[g].Mask;
+                    for (int bit = 0; bit < int(sizeof(KAFFINITY) * 8); ++bit) {
+                        if (mask & (KAFFINITY(1) << bit)) {
+                            siblings.append(item->Processor.GroupMask[g].Group * 64 + bit);
+                        }
+                    }
+                }
+                logical += siblings.size();
+                topology.cores.append(siblings);
+            } else if (item->Relationship == RelationProcessorPackage) {
+                packages++;
+            }
+            offset += item->Size;
+        }
+        topology.logicalCpus = qMax(1, logical);
+        topology.physicalCores = qMax(1, int(topology.cores.size()));
+        topology.packages = qMax(1, packages);
+    }
+#elif defined(__APPLE__)
+    int value = 0;
+    size_t size = sizeof(value);
+    if (sysctlbyname("hw.physicalcpu", &value, &size, nullptr, 0) == 0 && value > 0) {
+        topology.physicalCores = value;
+    }
+    size = sizeof(value);
+    if (sysctlbyname("hw.logicalcpu", &value, &size, nullptr, 0) == 0 && value > 0) {
+        topology.logicalCpus = value;
+    }
+    size = sizeof(value);
+    if (sysctlbyname("hw.packages", &value, &size, nullptr, 0) == 0 && value > 0) {
+        topology.packages = value;
+    }
+#endif
+
+    if (topology.cores.isEmpty()) {
+        // assume siblings are numbered consecutively
+        const int perCore = topology.threadsPerCore();
+        for (int core = 0; core < topology.physicalCores; ++core) {
+            QVector<int> siblings;
+            for (int t = 0; t < perCore; ++t) {
+                siblings.append(core * perCore + t);
+            }
+            topology.cores.append(siblings);
+        }
+    }
+
+    if (topology.nodes.isEmpty()) {
+        QVector<int> cpus;
+        for (const auto &siblings : topology.cores) {
+            cpus += siblings;
+        }
+        topology.nodes.append(cpus);
+    }
+
+    return topology;
+}
+
+QString HardwareInfo::hostId() {
+    const CpuTopology topology = cpuTopology();
+    return QString("%1-%2c%3t").arg(QSysInfo::machineHostName()).arg(topology.physicalCores).arg(topology.logicalCpus);
+}
+
+qint64 HardwareInfo::physicalMemoryBytes() {
+#if defined(_WIN32)
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    return GlobalMemoryStatusEx(&status) ? qint64(status.ullTotalPhys) : 0;
+#elif defined(__APPLE__)
+    int64_t value = 0;
+    size_t size = sizeof(value);
+    return sysctlbyname("hw.memsize", &value, &size, nullptr, 0) == 0 ? qint64(value) : 0;
+#else
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    return pages > 0 && pageSize > 0 ? qint64(pages) * pageSize : 0;
+#endif
+}
+
+qint64 HardwareInfo::residentMemoryBytes() {
+#if defined(_WIN32)
+    PROCESS_MEMORY_COUNTERS counters;
+    return GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)) ? qint64(counters.WorkingSetSize) : 0;
+#elif defined(__APPLE__)
+    mach_task_basic_info_data_t info;
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO, (task_info_t) &info, &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return qint64(info.resident_size);
+#else
+    // second field of statm is the resident page count
+    const QStringList fields = readSysFile("/proc/self/statm").split(' ');
+    const long pageSize = sysconf(_SC_PAGESIZE);
+    return fields.size() > 1 && pageSize > 0 ? fields.at(1).toLongLong() * pageSize : 0;
+#endif
+}
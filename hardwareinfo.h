@@ -0,0 +1,38 @@
+#ifndef HARDWAREINFO_H
+#define HARDWAREINFO_H
+
+#include <QString>
+#include <QVector>
+
+struct CpuTopology {
+    int logicalCpus   = 1;
+    int physicalCores = 1;
+    int packages      = 1;
+
+    // logical cpu ids grouped by physical core, SMT siblings share a group
+    QVector<QVector<int>> cores;
+
+    // logical cpu ids per NUMA node, a single node on non-NUMA hosts
+    QVector<QVector<int>> nodes;
+
+    int threadsPerCore() const { return physicalCores > 0 ? qMax(1, logicalCpus / physicalCores) : 1; }
+};
+
+class HardwareInfo {
+public:
+    static CpuTopology cpuTopology();
+
+    // stable identifier of the machine used to key persisted tuning data
+    static QString hostId();
+
+    // total installed memory, 0 when unknown
+    static qint64 physicalMemoryBytes();
+
+    // resident set size of this process, 0 when unknown
+    static qint64 residentMemoryBytes();
+
+    // parse a Linux cpu list such as "0-3,8,10-11"
+    static QVector<int> parseCpuList(const QString &list);
+};
+
+#endif // HARDWAREINFO_H
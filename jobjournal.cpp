@@ -0,0 +1,239 @@
+#include "jobjournal.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QJsonDocument>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDebug>
+
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+// rewrite once the file has this many lines and most of them are dead
+static const int kCompactMinRecords = 1000;
+static const int kCompactRatio = 8;
+
+JobJournal::JobJournal(const QString &path, QObject *parent)
+    : QObject(parent), path(path) {
+    syncTimer.setSingleShot(true);
+    syncTimer.setInterval(kSyncIntervalMs);
+    connect(&syncTimer, &QTimer::timeout, this, &JobJournal::sync);
+}
+
+JobJournal::~JobJournal() {
+    sync();
+}
+
+QString JobJournal::defaultPath() {
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/queue.journal";
+}
+
+bool JobJournal::open() {
+    if (file.isOpen()) {
+        return true;
+    }
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    file.setFileName(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Append)) {
+        qWarning() << "journal: cannot open" << path << file.errorString();
+        return false;
+    }
+    return true;
+}
+
+static QJsonObject enqueuedRecord(const JournalJob &job) {
+    QJsonObject record;
+    record["event"] = "enqueued";
+    record["id"] = job.id;
+    record["file"] = job.file;
+    record["output"] = job.outputFolder;
+    record["title"] = job.title;
+    record["link"] = job.link;
+    record["variant"] = job.modelVariant;
+    record["row"] = job.row;
+    record["priority"] = job.priority;
+    if (job.deadline.isValid()) {
+        record["deadline"] = job.deadline.toString(Qt::ISODate);
+    }
+    return record;
+}
+
+QVector<JournalJob> JobJournal::replay() {
+    pending.clear();
+    records = 0;
+
+    QFile input(path);
+    if (input.open(QIODevice::ReadOnly)) {
+        while (!input.atEnd()) {
+            const QByteArray line = input.readLine().trimmed();
+            const QJsonObject record = QJsonDocument::fromJson(line).object();
+            if (record.isEmpty()) {
+                // a line torn by the crash, everything before it is intact
+                continue;
+            }
+            records++;
+
+            const QString event = record["event"].toString();
+            const qint64 id = qint64(record["id"].toDouble());
+            lastId = qMax(lastId, id);
+            if (event == "enqueued") {
+                JournalJob job;
+                job.id = id;
+                job.file = record["file"].toString();
+                job.outputFolder = record["output"].toString();
+                job.title = record["title"].toString();
+                job.link = record["link"].toString();
+                job.modelVariant = record["variant"].toString();
+                job.row = record["row"].toInt();
+                job.priority = record["priority"].toInt();
+                job.deadline = QDateTime::fromString(record["deadline"].toString(), Qt::ISODate);
+                pending.insert(id, job);
+            } else if (!pending.contains(id)) {
+                continue;
+            } else if (event == "started") {
+                pending[id].started = true;
+            } else if (event == "checkpointed") {
+                pending[id].progress = record["progress"].toInt();
+            } else if (event == "finished" || event == "failed") {
+                pending.remove(id);
+            }
+        }
+        input.close();
+    }
+
+    qInfo("journal: %d pending job(s) from %d record(s) in %s", int(pending.size()), records, qPrintable(path));
+    compact();
+
+    QVector<JournalJob> jobs;
+    for (const auto &job : pending) {
+        jobs.append(job);
+    }
+    return jobs;
+}
+
+qint64 JobJournal::nextId() {
+    return ++lastId;
+}
+
+void JobJournal::enqueued(const JournalJob &job) {
+    lastId = qMax(lastId, job.id);
+    pending.insert(job.id, job);
+    append(enqueuedRecord(job));
+}
+
+void JobJournal::started(qint64 id) {
+    if (!pending.contains(id)) {
+        return;
+    }
+    pending[id].started = true;
+    QJsonObject record;
+    record["event"] = "started";
+    record["id"] = id;
+    append(record);
+}
+
+void JobJournal::checkpointed(qint64 id, int progress) {
+    if (!pending.contains(id) || pending[id].progress == progress) {
+        return;
+    }
+    pending[id].progress = progress;
+    QJsonObject record;
+    record["event"] = "checkpointed";
+    record["id"] = id;
+    record["progress"] = progress;
+    append(record);
+}
+
+void JobJournal::finished(qint64 id) {
+    if (pending.remove(id) == 0) {
+        return;
+    }
+    QJsonObject record;
+    record["event"] = "finished";
+    record["id"] = id;
+    append(record);
+}
+
+void JobJournal::failed(qint64 id, const QString &reason) {
+    if (pending.remove(id) == 0) {
+        return;
+    }
+    QJsonObject record;
+    record["event"] = "failed";
+    record["id"] = id;
+    record["reason"] = reason;
+    append(record);
+}
+
+void JobJournal::append(const QJsonObject &record) {
+    if (!open()) {
+        return;
+    }
+    QJsonObject stamped = record;
+    stamped["time"] = QDateTime::currentMSecsSinceEpoch();
+    // to the OS at once, a crash of the process alone then loses nothing
+    file.write(QJsonDocument(stamped).toJson(QJsonDocument::Compact) + '\n');
+    file.flush();
+    records++;
+
+    if (records >= kCompactMinRecords && records > kCompactRatio * qMax(1, int(pending.size()))) {
+        compact();
+    } else if (!syncTimer.isActive()) {
+        syncTimer.start();
+    }
+}
+
+void JobJournal::sync() {
+    syncTimer.stop();
+    if (!file.isOpen()) {
+        return;
+    }
+    file.flush();
+#if defined(_WIN32)
+    _commit(file.handle());
+#else
+    ::fsync(file.handle());
+#endif
+}
+
+void JobJournal::compact() {
+    syncTimer.stop();
+    file.close();
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile output(path);
+    if (!output.open(QIODevice::WriteOnly)) {
+        qWarning() << "journal: cannot compact" << path << output.errorString();
+        return;
+    }
+    int written = 0;
+    auto write = [&output, &written](QJsonObject record) {
+        record["time"] = QDateTime::currentMSecsSinceEpoch();
+        output.write(QJsonDocument(record).toJson(QJsonDocument::Compact) + '\n');
+        written++;
+    };
+    for (const auto &job : pending) {
+        write(enqueuedRecord(job));
+        if (job.started) {
+            QJsonObject record;
+            record["event"] = "started";
+            record["id"] = job.id;
+            write(record);
+        }
+        if (job.progress > 0) {
+            QJsonObject record;
+            record["event"] = "checkpointed";
+            record["id"] = job.id;
+            record["progress"] = job.progress;
+            write(record);
+        }
+    }
+    // the rename is atomic, a crash leaves either the old journal or the new one
+    if (output.commit()) {
+        records = written;
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef JOBJOURNAL_H
+#define JOBJOURNAL_H
+
+#include <QDateTime>
+#include <QJsonObject>
+#include <QFile>
+#include <QMap>
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVector>
+
+struct JournalJob {
+    qint64 id = 0;
+    QString file;
+    QString outputFolder;
+    QString title;
+    QString link;
+    QString modelVariant;
+    int row = 0;
+    int priority = 0;
+    QDateTime deadline;
+    bool started = false;
+    int progress = 0;    // last checkpoint, a restarted job still begins from the start
+};
+
+// Append-only log of job lifecycle events, one JSON object per line, so a crash or restart
+// does not lose a long batch. Appends go to the OS right away and are fsynced in batches
+// every kSyncIntervalMs: a crash can forget the last few events, which at worst transcribes
+// a finished file again. Once it holds mostly dead records the file is rewritten to the
+// pending jobs only.
+class JobJournal : public QObject {
+    Q_OBJECT
+
+public:
+    explicit JobJournal(const QString &path = defaultPath(), QObject *parent = nullptr);
+    ~JobJournal();
+
+    static QString defaultPath();
+
+    // enqueued jobs that neither finished nor failed, in submission order; compacts the file
+    QVector<JournalJob> replay();
+
+    // the id for the next enqueued job
+    qint64 nextId();
+
+    void enqueued(const JournalJob &job);
+    void started(qint64 id);
+    void checkpointed(qint64 id, int progress);
+    void finished(qint64 id);
+    void failed(qint64 id, const QString &reason);
+
+    // writes out everything appended so far
+    void sync();
+
+private:
+    static const int kSyncIntervalMs = 250;
+
+    bool open();
+    void append(const QJsonObject &record);
+    void compact();
+
+    QString path;
+    QFile file;
+    QTimer syncTimer;
+    QMap<qint64, JournalJob> pending;
+    qint64 lastId = 0;
+    int records = 0; // lines in the file
+};
+
+#endif // JOBJOURNAL_H
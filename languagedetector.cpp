@@ -0,0 +1,67 @@
+#include "languagedetector.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QSettings>
+#include <QDebug>
+
+#include <algorithm>
+
+std::string LanguageDetector::detectionModel(const whisper_params &params) {
+    if (!params.detect_model.empty()) {
+        return params.detect_model;
+    }
+    return params.preview_model.empty() ? params.model : params.preview_model;
+}
+
+QString LanguageDetector::cacheKey(const QString &file) {
+    const QFileInfo info(file);
+    const QString identity = QString("%1|%2|%3").arg(info.absoluteFilePath()).arg(info.size()).arg(info.lastModified().toMSecsSinceEpoch());
+    return "language/" + QString::fromLatin1(QCryptographicHash::hash(identity.toUtf8(), QCryptographicHash::Sha1).toHex());
+}
+
+QString LanguageDetector::detect(const QString &file, const std::vector<float> &pcmf32, const whisper_params &params, float *probability) {
+    QSettings settings("ImproveYourMix", "VideoTranscriber");
+    const QString key = cacheKey(file);
+
+    QString language = settings.value(key + "/language").toString();
+    float p = settings.value(key + "/probability").toFloat();
+    if (language.isEmpty()) {
+        whisper_params detectParams = params;
+        detectParams.model = detectionModel(params);
+
+        // stays resident for the next file, detection models are small
+        const std::string modelPath = Transcriber::modelPath(detectParams).toStdString();
+        const ModelLease model = ModelManager::instance().acquire(QString::fromStdString(modelPath), params.use_gpu);
+        if (!model.isValid()) {
+            return QString();
+        }
+        if (!whisper_is_multilingual(model.context())) {
+            qWarning() << "language:" << QString::fromStdString(modelPath) << "is English-only";
+            return QString();
+        }
+
+        // only the beginning is needed, detection looks at a single window anyway
+        const size_t n = std::min(pcmf32.size(), size_t(params.detect_ms) * WHISPER_SAMPLE_RATE / 1000);
+        std::vector<float> probs(whisper_lang_max_id() + 1, 0.0f);
+        int id = -1;
+        if (whisper_pcm_to_mel_with_state(model.context(), model.whisperState(), pcmf32.data(), int(n), params.n_threads) == 0) {
+            id = whisper_lang_auto_detect_with_state(model.context(), model.whisperState(), 0, params.n_threads, probs.data());
+        }
+        if (id < 0) {
+            return QString();
+        }
+
+        language = QString::fromLatin1(whisper_lang_str(id));
+        p = probs[id];
+        settings.setValue(key + "/language", language);
+        settings.setValue(key + "/probability", p);
+        qInfo("language: %s p = %.2f from %s", whisper_lang_str(id), p, modelPath.c_str());
+    }
+
+    if (probability) {
+        *probability = p;
+    }
+    return p >= params.detect_min_p ? language : QString();
+}
@@ -0,0 +1,22 @@
+#ifndef LANGUAGEDETECTOR_H
+#define LANGUAGEDETECTOR_H
+
+#include <QString>
+#include <vector>
+#include "transcriber.h"
+
+// Spoken language of a file from a short pass with a small multilingual model,
+// remembered per file (path, size and modification time) across runs.
+class LanguageDetector {
+public:
+    // language code, empty when the detection is below params.detect_min_p or failed
+    static QString detect(const QString &file, const std::vector<float> &pcmf32, const whisper_params &params, float *probability = nullptr);
+
+    // params.detect_model, else the preview model, else the configured one
+    static std::string detectionModel(const whisper_params &params);
+
+private:
+    static QString cacheKey(const QString &file);
+};
+
+#endif // LANGUAGEDETECTOR_H
@@ -1,9 +1,194 @@
 #include "mainwindow.h"
+#include "threadtuner.h"
+#include "streamtranscriber.h"
+#include "benchmark.h"
+#include "modelvariants.h"
+#include "workerprocess.h"
+#include "coordinator.h"
+#include "nodeagent.h"
 
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+
+// command line modes that run without a window
+static bool isHeadless(int argc, char *argv[])
+{
+    const char *modes[] = { "--calibrate", "--stream", "--benchmark", "--quantize", "--worker", "--coordinator", "--node", "--submit" };
+    for (int i = 1; i < argc; ++i) {
+        for (const char *mode : modes) {
+            if (qstrcmp(argv[i], mode) == 0) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+static int runHeadless(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    whisper_params params;
+
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption calibrateOption("calibrate", "Measure jobs x threads configurations for the model and store the fastest for this host.");
+    QCommandLineOption modelOption("model", "Model path, relative to the executable.", "path", QString::fromStdString(params.model));
+    QCommandLineOption variantOption("variant", "Quantized variant of the model, made next to it on first use.", "type");
+    QCommandLineOption quantizeOption("quantize", "Make the quantized variant of the model (" + ModelVariants::supportedTypes().join(", ") + ") and exit.", "type");
+    QCommandLineOption cpuOption("cpu", "Do not use the GPU.");
+    QCommandLineOption melCacheOption("mel-cache", "Reuse log-mel spectrograms of audio seen before, needs --brief-json.");
+    QCommandLineOption briefJsonOption("brief-json", "Write segments without per-token data and timestamps.");
+    QCommandLineOption threadsOption("threads", "Threads per transcription.", "n", QString::number(params.n_threads));
+    QCommandLineOption decodingOption("decoding", "greedy, beam (beam search throughout) or adaptive (beam search where greedy is unsure).", "mode", "greedy");
+    QCommandLineOption beamSizeOption("beam-size", "Beams for beam and adaptive decoding.", "n", QString::number(params.beam_size));
+    QCommandLineOption languageOption("language", "Spoken language.", "lang", QString::fromStdString(params.language));
+    QCommandLineOption streamOption("stream", "Transcribe 16 kHz PCM (raw s16le or WAV) from stdin ('-') or a pipe, printing JSON lines.", "input");
+    QCommandLineOption stepOption("step", "Streaming: audio consumed per step.", "ms", "3000");
+    QCommandLineOption lengthOption("length", "Streaming: window length, bounds the latency of final segments.", "ms", "10000");
+    QCommandLineOption keepOption("keep", "Streaming: overlap carried into the next window.", "ms", "200");
+    QCommandLineOption partialOption("partial", "Streaming: also print non-final hypotheses after every step.");
+    QCommandLineOption benchmarkOption("benchmark", "Transcribe every audio file with a <name>.txt reference in the directory and report WER, CER, RTF and memory.", "dir");
+    QCommandLineOption configsOption("configs", "Benchmark: configurations, greedy, full-ctx, beam or adaptive, each optionally @<model>.", "list",
+                                     "greedy,full-ctx,beam,adaptive");
+    QCommandLineOption coordinatorOption("coordinator", "Queue the given files and hand them to the nodes that register on the TCP port.", "port");
+    QCommandLineOption listenOption("listen", "Coordinator: address to accept nodes on, 0.0.0.0 for every interface.", "address", "127.0.0.1");
+    QCommandLineOption tokenOption("token", "Coordinator, node and submit: shared secret every connection has to present.", "secret");
+    QCommandLineOption nodeOption("node", "Run jobs from the coordinator at host:port.", "host:port");
+    QCommandLineOption slotsOption("slots", "Node: concurrent jobs, the calibrated value by default.", "n");
+    QCommandLineOption localOption("local", "Node: directory on this machine's local disk, jobs under it are preferably sent here. Repeatable.", "dir");
+    QCommandLineOption submitOption("submit", "Add the given files to the queue of the coordinator at host:port.", "host:port");
+    QCommandLineOption outputOption("output", "Coordinator and submit: output folder, next to each file by default.", "dir");
+    QCommandLineOption workerOption("worker", "Internal: serve transcription jobs for the application listening on the server.", "server");
+    parser.addOption(calibrateOption);
+    parser.addOption(modelOption);
+    parser.addOption(variantOption);
+    parser.addOption(quantizeOption);
+    parser.addOption(cpuOption);
+    parser.addOption(melCacheOption);
+    parser.addOption(briefJsonOption);
+    parser.addOption(threadsOption);
+    parser.addOption(decodingOption);
+    parser.addOption(beamSizeOption);
+    parser.addOption(languageOption);
+    parser.addOption(streamOption);
+    parser.addOption(stepOption);
+    parser.addOption(lengthOption);
+    parser.addOption(keepOption);
+    parser.addOption(partialOption);
+    parser.addOption(benchmarkOption);
+    parser.addOption(configsOption);
+    parser.addOption(coordinatorOption);
+    parser.addOption(listenOption);
+    parser.addOption(tokenOption);
+    parser.addOption(nodeOption);
+    parser.addOption(slotsOption);
+    parser.addOption(localOption);
+    parser.addOption(submitOption);
+    parser.addOption(outputOption);
+    parser.addOption(workerOption);
+    parser.addPositionalArgument("files", "Coordinator and submit: files to transcribe.", "[files...]");
+    parser.process(a);
+
+    params.model = parser.value(modelOption).toStdString();
+    params.model_variant = parser.value(variantOption).toStdString();
+    params.use_gpu = !parser.isSet(cpuOption);
+    params.mel_cache = parser.isSet(melCacheOption);
+    params.output_jsn_full = !parser.isSet(briefJsonOption);
+    params.n_threads = qMax(1, parser.value(threadsOption).toInt());
+    params.language = parser.value(languageOption).toStdString();
+    params.beam_size = qMax(1, parser.value(beamSizeOption).toInt());
+    if (!Transcriber::setDecoding(params, parser.value(decodingOption))) {
+        qWarning() << "unknown decoding" << parser.value(decodingOption) << "- use greedy, beam or adaptive";
+        return 1;
+    }
+
+    if (parser.isSet(workerOption)) {
+        WorkerProcess worker(parser.value(workerOption));
+        if (!worker.start()) {
+            return 1;
+        }
+        return a.exec();
+    }
+    if (parser.isSet(coordinatorOption)) {
+        Coordinator coordinator(params);
+        coordinator.setToken(parser.value(tokenOption));
+        if (!coordinator.listen(QHostAddress(parser.value(listenOption)), quint16(parser.value(coordinatorOption).toUInt()))) {
+            return 1;
+        }
+        // with files on the command line this is a batch, otherwise a service fed by --submit
+        const QStringList files = parser.positionalArguments();
+        for (const auto &file : files) {
+            coordinator.add(file, parser.value(outputOption));
+        }
+        coordinator.setExitWhenDone(!files.isEmpty());
+        return a.exec();
+    }
+    if (parser.isSet(nodeOption) || parser.isSet(submitOption)) {
+        const QString address = parser.value(parser.isSet(nodeOption) ? nodeOption : submitOption);
+        const QString host = address.section(':', 0, -2);
+        const quint16 port = quint16(address.section(':', -1).toUInt());
+        if (host.isEmpty() || port == 0) {
+            qWarning() << "expected host:port, got" << address;
+            return 1;
+        }
+        if (parser.isSet(submitOption)) {
+            return Coordinator::submit(host, port, parser.positionalArguments(), parser.value(outputOption), parser.value(tokenOption));
+        }
+        const int capacity = parser.isSet(slotsOption) ? parser.value(slotsOption).toInt() : ThreadTuner::load(params).jobs;
+        if (!parser.isSet(threadsOption)) {
+            params.n_threads = ThreadTuner::load(params).threads;
+        }
+        NodeAgent node(host, port, capacity, parser.values(localOption), params);
+        node.setToken(parser.value(tokenOption));
+        node.start();
+        return a.exec();
+    }
+    if (parser.isSet(quantizeOption)) {
+        params.model_variant.clear();
+        const QString path = ModelVariants::ensure(Transcriber::modelPath(params), parser.value(quantizeOption));
+        if (path.isEmpty()) {
+            return 1;
+        }
+        printf("%s\n", qPrintable(path));
+        return 0;
+    }
+    if (parser.isSet(calibrateOption)) {
+        return ThreadTuner::calibrate(params).calibrated ? 0 : 1;
+    }
+    if (parser.isSet(streamOption)) {
+        // the model loads while the producer connects and the first step fills
+        Transcriber::preloadModels(params);
+        StreamTranscriber stream(params, parser.value(stepOption).toInt(), parser.value(lengthOption).toInt(), parser.value(keepOption).toInt());
+        stream.setEmitPartial(parser.isSet(partialOption));
+        return stream.run(parser.value(streamOption));
+    }
+    if (parser.isSet(benchmarkOption)) {
+        Benchmark benchmark(parser.value(benchmarkOption));
+        if (benchmark.samples().isEmpty()) {
+            qWarning("benchmark: no audio files with a reference transcript");
+            return 1;
+        }
+        printf("%-40s %6s %6s %8s %8s %8s %10s %10s\n", "config", "files", "failed", "WER", "CER", "RTF", "peak MB", "seconds");
+        for (const auto &config : Benchmark::configs(parser.value(configsOption).split(',', Qt::SkipEmptyParts), params)) {
+            // every configuration loads its own model, its memory and timings do not depend on the order
+            ModelManager::instance().clear();
+            const BenchmarkResult result = benchmark.run(config);
+            printf("%-40s %6d %6d %7.2f%% %7.2f%% %8.3f %10lld %10.1f\n", qPrintable(result.config), result.files, result.failed, result.wer * 100.0,
+                   result.cer * 100.0, result.rtf, (long long) (result.peakRssBytes / (1024 * 1024)), result.seconds);
+            fflush(stdout);
+        }
+        return 0;
+    }
+    return 0;
+}
 
 int main(int argc, char *argv[])
 {
+    if (isHeadless(argc, argv)) {
+        return runHeadless(argc, argv);
+    }
+
     QApplication a(argc, argv);
     MainWindow w;
     w.show();
@@ -0,0 +1,156 @@
+#include "mediaprobe.h"
+
+#include <QFile>
+#include <QtEndian>
+
+MediaProbe::Container MediaProbe::container(const QString &file) {
+    QFile f(file);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return Unknown;
+    }
+    const QByteArray head = f.read(16);
+    if (head.size() < 12) {
+        return Unknown;
+    }
+
+    const uchar *b = reinterpret_cast<const uchar *>(head.constData());
+    if (head.startsWith("RIFF") && head.mid(8, 4) == "WAVE") {
+        return Wav;
+    }
+    if (head.mid(4, 4) == "ftyp" || head.mid(4, 4) == "moov" || head.mid(4, 4) == "mdat" || head.mid(4, 4) == "wide") {
+        return IsoBmff;
+    }
+    if (b[0] == 0x1A && b[1] == 0x45 && b[2] == 0xDF && b[3] == 0xA3) {
+        return Matroska;
+    }
+    if (head.startsWith("ID3") || (b[0] == 0xFF && (b[1] & 0xE0) == 0xE0)) {
+        return Mp3;
+    }
+    if (head.startsWith("fLaC")) {
+        return Flac;
+    }
+    if (head.startsWith("OggS")) {
+        return Ogg;
+    }
+    return Unknown;
+}
+
+QString MediaProbe::containerName(Container container) {
+    switch (container) {
+    case Wav:      return "wav";
+    case IsoBmff:  return "mp4/mov";
+    case Matroska: return "matroska";
+    case Mp3:      return "mp3";
+    case Flac:     return "flac";
+    case Ogg:      return "ogg";
+    default:       return "unknown";
+    }
+}
+
+qint64 MediaProbe::durationMs(const QString &file) {
+    qint64 duration = wavDurationMs(file);
+    if (duration < 0) {
+        duration = isoBmffDurationMs(file);
+    }
+    return duration;
+}
+
+qint64 MediaProbe::wavDurationMs(const QString &file) {
+    QFile f(file);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+
+    const QByteArray riff = f.read(12);
+    if (riff.size() < 12 || !riff.startsWith("RIFF") || riff.mid(8, 4) != "WAVE") {
+        return -1;
+    }
+
+    quint32 byteRate = 0;
+    while (!f.atEnd()) {
+        const QByteArray header = f.read(8);
+        if (header.size() < 8) {
+            break;
+        }
+        const QByteArray id = header.left(4);
+        const quint32 size = qFromLittleEndian<quint32>(header.constData() + 4);
+
+        if (id == "fmt ") {
+            const QByteArray fmt = f.read(qMin<quint32>(size, 16));
+            if (fmt.size() < 12) {
+                return -1;
+            }
+            byteRate = qFromLittleEndian<quint32>(fmt.constData() + 8);
+            f.seek(f.pos() + size - fmt.size() + (size & 1));
+        } else if (id == "data") {
+            if (byteRate == 0) {
+                return -1;
+            }
+            // streamed WAVs leave the size unset, fall back to what is on disk
+            const quint64 dataSize = (size == 0 || size == 0xFFFFFFFF) ? quint64(f.size() - f.pos()) : size;
+            return qint64(dataSize * 1000 / byteRate);
+        } else {
+            f.seek(f.pos() + size + (size & 1));
+        }
+    }
+    return -1;
+}
+
+// mp4 / mov / m4a: the movie header box carries the duration
+qint64 MediaProbe::isoBmffDurationMs(const QString &file) {
+    QFile f(file);
+    if (!f.open(QIODevice::ReadOnly)) {
+        return -1;
+    }
+
+    // walk boxes in [begin, end), descending into moov
+    qint64 begin = 0;
+    qint64 end = f.size();
+    while (begin + 8 <= end) {
+        f.seek(begin);
+        const QByteArray header = f.read(16);
+        if (header.size() < 8) {
+            break;
+        }
+        quint64 size = qFromBigEndian<quint32>(header.constData());
+        const QByteArray type = header.mid(4, 4);
+        int headerSize = 8;
+        if (size == 1 && header.size() >= 16) {
+            size = qFromBigEndian<quint64>(header.constData() + 8);
+            headerSize = 16;
+        } else if (size == 0) {
+            size = quint64(end - begin);
+        }
+        if (size < quint64(headerSize)) {
+            break;
+        }
+
+        if (type == "moov") {
+            end = begin + qint64(size);
+            begin += headerSize;
+            continue;
+        }
+
+        if (type == "mvhd") {
+            f.seek(begin + headerSize);
+            const QByteArray box = f.read(32);
+            if (box.size() < 20) {
+                return -1;
+            }
+            const int version = quint8(box[0]);
+            quint32 timescale = 0;
+            quint64 duration = 0;
+            if (version == 1 && box.size() >= 32) {
+                timescale = qFromBigEndian<quint32>(box.constData() + 20);
+                duration = qFromBigEndian<quint64>(box.constData() + 24);
+            } else {
+                timescale = qFromBigEndian<quint32>(box.constData() + 12);
+                duration = qFromBigEndian<quint32>(box.constData() + 16);
+            }
+            return timescale > 0 ? qint64(duration * 1000 / timescale) : -1;
+        }
+
+        begin += qint64(size);
+    }
+    return -1;
+}
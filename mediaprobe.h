@@ -0,0 +1,31 @@
+#ifndef MEDIAPROBE_H
+#define MEDIAPROBE_H
+
+#include <QString>
+
+// Cheap media inspection from headers only, no decoding.
+class MediaProbe {
+public:
+    enum Container {
+        Unknown,
+        Wav,
+        IsoBmff,   // mp4, mov, m4a
+        Matroska,  // mkv, webm
+        Mp3,
+        Flac,
+        Ogg
+    };
+
+    // container detected from the leading magic bytes, independent of the file suffix
+    static Container container(const QString &file);
+    static QString containerName(Container container);
+
+    // duration in milliseconds, -1 when it cannot be determined without decoding
+    static qint64 durationMs(const QString &file);
+
+private:
+    static qint64 wavDurationMs(const QString &file);
+    static qint64 isoBmffDurationMs(const QString &file);
+};
+
+#endif // MEDIAPROBE_H
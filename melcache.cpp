@@ -0,0 +1,117 @@
+#include "melcache.h"
+#include "ggml.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include <QDebug>
+
+#include <cstring>
+
+namespace {
+struct MelHeader {
+    char magic[4];
+    qint32 version;
+    qint32 n_mel;
+    qint32 n_len;
+};
+}
+
+MelCache::MelCache(qint64 maxBytes, const QString &directory)
+    : directory(directory), maxBytes(maxBytes) {}
+
+QString MelCache::defaultDirectory() {
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/mel";
+}
+
+QByteArray MelCache::key(const std::vector<float> &pcmf32, const std::vector<float> &filters, int n_mel) {
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(reinterpret_cast<const char *>(pcmf32.data()), int(pcmf32.size() * sizeof(float)));
+    hash.addData(reinterpret_cast<const char *>(filters.data()), int(filters.size() * sizeof(float)));
+    return hash.result().toHex() + "-" + QByteArray::number(n_mel);
+}
+
+QString MelCache::path(const QByteArray &key) const {
+    return directory + "/" + QString::fromLatin1(key) + ".mel";
+}
+
+bool MelCache::load(const QByteArray &key, int n_mel, std::vector<float> &mel, int &n_len) const {
+    QFile file(path(key));
+    if (!file.open(QIODevice::ReadWrite)) {
+        return false;
+    }
+
+    MelHeader header;
+    if (file.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header)
+        || memcmp(header.magic, "MELC", 4) != 0 || header.version != 1 || header.n_mel != n_mel || header.n_len <= 0) {
+        qWarning() << "mel cache: ignoring damaged entry" << file.fileName();
+        return false;
+    }
+
+    const qint64 count = qint64(header.n_mel) * header.n_len;
+    std::vector<ggml_fp16_t> data(count);
+    const qint64 bytes = count * qint64(sizeof(ggml_fp16_t));
+    if (file.read(reinterpret_cast<char *>(data.data()), bytes) != bytes) {
+        qWarning() << "mel cache: truncated entry" << file.fileName();
+        return false;
+    }
+
+    mel.resize(count);
+    ggml_fp16_to_fp32_row(data.data(), mel.data(), count);
+    n_len = header.n_len;
+
+    // modification time doubles as last use for eviction
+    file.setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+    return true;
+}
+
+bool MelCache::store(const QByteArray &key, int n_mel, const std::vector<float> &mel, int n_len) {
+    if (!QDir().mkpath(directory)) {
+        return false;
+    }
+
+    MelHeader header;
+    memcpy(header.magic, "MELC", 4);
+    header.version = 1;
+    header.n_mel = n_mel;
+    header.n_len = n_len;
+
+    std::vector<ggml_fp16_t> data(mel.size());
+    ggml_fp32_to_fp16_row(mel.data(), data.data(), int64_t(mel.size()));
+
+    // concurrent jobs may store the same audio, readers only ever see complete files
+    QSaveFile file(path(key));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return false;
+    }
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char *>(data.data()), qint64(data.size() * sizeof(ggml_fp16_t)));
+    if (!file.commit()) {
+        qWarning() << "mel cache: failed to write" << path(key);
+        return false;
+    }
+
+    evict();
+    return true;
+}
+
+void MelCache::evict() {
+    if (maxBytes <= 0) {
+        return;
+    }
+
+    // newest first, keep as many as fit
+    const QFileInfoList entries = QDir(directory).entryInfoList(QStringList() << "*.mel", QDir::Files, QDir::Time);
+    qint64 total = 0;
+    for (const auto &entry : entries) {
+        total += entry.size();
+        if (total > maxBytes) {
+            qInfo() << "mel cache: evicting" << entry.fileName();
+            QFile::remove(entry.absoluteFilePath());
+        }
+    }
+}
@@ -0,0 +1,32 @@
+#ifndef MELCACHE_H
+#define MELCACHE_H
+
+#include <QByteArray>
+#include <QString>
+#include <vector>
+
+// On-disk cache of log-mel spectrograms keyed by a hash of the PCM, so re-runs of a
+// file with other decoding parameters skip the mel computation. Stored as f16, the
+// least recently used entries are dropped once the directory grows past maxBytes.
+class MelCache {
+public:
+    explicit MelCache(qint64 maxBytes, const QString &directory = defaultDirectory());
+
+    static QString defaultDirectory();
+
+    // identifies the audio and the filterbank, the model does not matter otherwise
+    static QByteArray key(const std::vector<float> &pcmf32, const std::vector<float> &filters, int n_mel);
+
+    // mel laid out as [n_mel][n_len], false on a miss or a damaged entry
+    bool load(const QByteArray &key, int n_mel, std::vector<float> &mel, int &n_len) const;
+    bool store(const QByteArray &key, int n_mel, const std::vector<float> &mel, int n_len);
+
+private:
+    QString path(const QByteArray &key) const;
+    void evict();
+
+    QString directory;
+    qint64 maxBytes;
+};
+
+#endif // MELCACHE_H
@@ -0,0 +1,309 @@
+#include "modelmanager.h"
+#include "modelverifier.h"
+
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QDebug>
+
+#include <memory>
+
+ModelLease::ModelLease(ModelLease &&other) noexcept {
+    *this = std::move(other);
+}
+
+ModelLease &ModelLease::operator=(ModelLease &&other) noexcept {
+    if (this != &other) {
+        release();
+        ctx = other.ctx;
+        state = other.state;
+        hit = other.hit;
+        reusable = other.reusable;
+        loadTimeMs = other.loadTimeMs;
+        errorText = other.errorText;
+        other.ctx = nullptr;
+        other.state = nullptr;
+    }
+    return *this;
+}
+
+ModelLease::~ModelLease() {
+    release();
+}
+
+void ModelLease::release() {
+    if (ctx) {
+        ModelManager::instance().release(ctx, state, reusable);
+    } else if (state) {
+        whisper_free_state(state);
+    }
+    ctx = nullptr;
+    state = nullptr;
+}
+
+ModelManager &ModelManager::instance() {
+    static ModelManager manager;
+    return manager;
+}
+
+ModelManager::~ModelManager() {
+    for (auto &thread : preloads) {
+        thread.join();
+    }
+    clear();
+}
+
+void ModelManager::setBudgetBytes(qint64 bytes) {
+    QMutexLocker locker(&mutex);
+    budgetBytes = qMax<qint64>(0, bytes);
+}
+
+ModelManager::Entry *ModelManager::find(const QString &path, bool useGpu) const {
+    for (auto *entry : entries) {
+        if (entry->path == path && entry->useGpu == useGpu) {
+            return entry;
+        }
+    }
+    return nullptr;
+}
+
+ModelManager::Entry *ModelManager::insert(const QString &path, bool useGpu) {
+    Entry *entry = new Entry;
+    entry->path = path;
+    entry->useGpu = useGpu;
+    entry->bytes = QFileInfo(path).size();
+    entry->loading = true;
+    evict(entry->bytes);
+    entries.append(entry);
+    return entry;
+}
+
+bool ModelManager::load(Entry *entry, int warmupThreads, QString *error) {
+    const QString path = entry->path;
+    const bool useGpu = entry->useGpu;
+    mutex.unlock();
+
+    // a damaged file fails here in milliseconds instead of halfway through the load
+    QElapsedTimer timer;
+    timer.start();
+    const QString problem = ModelVerifier::verify(path);
+    struct whisper_context *ctx = nullptr;
+    if (problem.isEmpty()) {
+        // the weights only, every lease brings its own state
+        whisper_context_params cparams = whisper_context_default_params();
+        cparams.use_gpu = useGpu;
+        ctx = whisper_init_from_file_with_params_no_state(path.toLocal8Bit().constData(), cparams);
+    }
+    const qint64 loadMs = timer.elapsed();
+
+    struct whisper_state *state = nullptr;
+    if (ctx && warmupThreads > 0) {
+        state = whisper_init_state(ctx);
+        if (state) {
+            warmUp(ctx, state, warmupThreads);
+        }
+        qInfo("model: preloaded %s in %lld ms, warm-up %lld ms", qPrintable(QFileInfo(path).fileName()), (long long) loadMs,
+              (long long) (timer.elapsed() - loadMs));
+    }
+
+    mutex.lock();
+    entry->loading = false;
+    counters.loadMs += loadMs;
+    loaded.wakeAll();
+    if (!ctx) {
+        if (error) {
+            *error = problem.isEmpty() ? QString("Failed to load model %1").arg(QFileInfo(path).fileName()) : problem;
+        }
+        qWarning() << "model: failed to load" << path << problem;
+        entries.removeOne(entry);
+        delete entry;
+        return false;
+    }
+    entry->ctx = ctx;
+    entry->spare = state;
+    return true;
+}
+
+// one second of faint noise through mel, encoder and a few decoder steps
+void ModelManager::warmUp(struct whisper_context *ctx, struct whisper_state *state, int threads) {
+    std::vector<float> pcmf32(WHISPER_SAMPLE_RATE);
+    uint32_t seed = 1;
+    for (auto &sample : pcmf32) {
+        seed = seed * 1664525u + 1013904223u;
+        sample = (float(seed >> 8) / float(1 << 24) - 0.5f) * 0.002f;
+    }
+
+    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+    wparams.n_threads        = threads;
+    wparams.print_realtime   = false;
+    wparams.print_progress   = false;
+    wparams.print_timestamps = false;
+    wparams.print_special    = false;
+    wparams.no_context       = true;
+    wparams.single_segment   = true;
+    wparams.max_tokens       = 4;
+    wparams.language         = "en";
+    whisper_full_with_state(ctx, state, wparams, pcmf32.data(), int(pcmf32.size()));
+}
+
+ModelLease ModelManager::acquire(const QString &path, bool useGpu) {
+    ModelLease lease;
+    QMutexLocker locker(&mutex);
+
+    // a preload or another job may be loading the same model right now, share its result
+    QElapsedTimer waited;
+    waited.start();
+    Entry *entry = find(path, useGpu);
+    while (entry && entry->loading) {
+        loaded.wait(&mutex);
+        entry = find(path, useGpu);
+    }
+
+    if (entry) {
+        counters.hits++;
+        lease.hit = true;
+        lease.loadTimeMs = waited.elapsed();
+    } else {
+        counters.misses++;
+        QElapsedTimer timer;
+        timer.start();
+        entry = insert(path, useGpu);
+        if (!load(entry, 0, &lease.errorText)) {
+            return lease;
+        }
+        lease.loadTimeMs = timer.elapsed();
+    }
+
+    entry->users++;
+    entry->lastUsed = ++clock;
+    lease.ctx = entry->ctx;
+    lease.state = entry->spare;
+    entry->spare = nullptr;
+
+    qint64 residentBytes = 0;
+    for (const auto *e : entries) {
+        residentBytes += e->bytes;
+    }
+    qInfo("model: %s %s in %lld ms, %d resident (%lld of %lld MB), %lld hits %lld misses %lld evictions", lease.hit ? "hit" : "loaded",
+          qPrintable(QFileInfo(path).fileName()), (long long) lease.loadTimeMs, int(entries.size()), (long long) (residentBytes >> 20),
+          (long long) (budgetBytes >> 20), (long long) counters.hits, (long long) counters.misses, (long long) counters.evictions);
+
+    // the state holds the KV caches and compute buffers, allocated outside the lock
+    locker.unlock();
+    if (!lease.state) {
+        lease.state = whisper_init_state(lease.ctx);
+    }
+    if (!lease.state) {
+        qWarning() << "model: failed to allocate a state for" << path;
+        lease.release();
+        lease.errorText = "Not enough memory for a decoder state";
+    }
+    return lease;
+}
+
+std::shared_future<bool> ModelManager::preload(const QString &path, bool useGpu, int warmupThreads) {
+    auto promise = std::make_shared<std::promise<bool>>();
+    std::shared_future<bool> result = promise->get_future().share();
+
+    QMutexLocker locker(&mutex);
+    if (find(path, useGpu)) {
+        promise->set_value(true);
+        return result;
+    }
+    counters.preloads++;
+    Entry *entry = insert(path, useGpu);
+    preloads.emplace_back([this, entry, promise, warmupThreads]() {
+        QMutexLocker locker(&mutex);
+        promise->set_value(load(entry, qMax(1, warmupThreads), nullptr));
+    });
+    return result;
+}
+
+void ModelManager::release(struct whisper_context *ctx, struct whisper_state *state, bool reusable) {
+    QMutexLocker locker(&mutex);
+    for (auto *entry : entries) {
+        if (entry->ctx == ctx) {
+            entry->users--;
+            // one state per model is kept, the next job skips allocating and faulting it in
+            if (state && reusable && !entry->spare) {
+                entry->spare = state;
+                state = nullptr;
+            }
+            break;
+        }
+    }
+    if (state) {
+        whisper_free_state(state);
+    }
+    // models pinned while the budget was exceeded may go now
+    evict(0);
+}
+
+void ModelManager::evict(qint64 incomingBytes) {
+    qint64 residentBytes = 0;
+    for (const auto *entry : entries) {
+        residentBytes += entry->bytes;
+    }
+
+    while (residentBytes + incomingBytes > budgetBytes) {
+        Entry *victim = nullptr;
+        for (auto *entry : entries) {
+            if (entry->users == 0 && !entry->loading && (!victim || entry->lastUsed < victim->lastUsed)) {
+                victim = entry;
+            }
+        }
+        if (!victim) {
+            break;
+        }
+        qInfo() << "model: evicting" << QFileInfo(victim->path).fileName();
+        residentBytes -= victim->bytes;
+        entries.removeOne(victim);
+        if (victim->spare) {
+            whisper_free_state(victim->spare);
+        }
+        whisper_free(victim->ctx);
+        delete victim;
+        counters.evictions++;
+    }
+}
+
+ModelStats ModelManager::stats() const {
+    QMutexLocker locker(&mutex);
+    ModelStats result = counters;
+    for (const auto *entry : entries) {
+        if (!entry->loading) {
+            result.residentBytes += entry->bytes;
+            result.resident++;
+        }
+    }
+    return result;
+}
+
+bool ModelManager::contains(const QString &path, bool useGpu) const {
+    QMutexLocker locker(&mutex);
+    return find(path, useGpu) != nullptr;
+}
+
+qint64 ModelManager::committedBytes() const {
+    QMutexLocker locker(&mutex);
+    qint64 bytes = 0;
+    for (const auto *entry : entries) {
+        bytes += entry->bytes;
+    }
+    return bytes;
+}
+
+void ModelManager::clear() {
+    QMutexLocker locker(&mutex);
+    for (int i = entries.size() - 1; i >= 0; --i) {
+        Entry *entry = entries.at(i);
+        if (entry->users == 0 && !entry->loading) {
+            entries.removeAt(i);
+            if (entry->spare) {
+                whisper_free_state(entry->spare);
+            }
+            whisper_free(entry->ctx);
+            delete entry;
+        }
+    }
+}
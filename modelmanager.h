@@ -0,0 +1,117 @@
+#ifndef MODELMANAGER_H
+#define MODELMANAGER_H
+
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QWaitCondition>
+#include <future>
+#include <thread>
+#include <vector>
+#include "whisper.h"
+
+struct ModelStats {
+    qint64 hits = 0;
+    qint64 misses = 0;
+    qint64 evictions = 0;
+    qint64 loadMs = 0;        // total time spent loading models
+    qint64 preloads = 0;
+    qint64 residentBytes = 0;
+    int resident = 0;         // models in memory
+};
+
+// A resident model and a decoder state of its own. The model cannot be evicted
+// while a lease on it exists; moving transfers that, destruction releases it.
+class ModelLease {
+public:
+    ModelLease() = default;
+    ModelLease(ModelLease &&other) noexcept;
+    ModelLease &operator=(ModelLease &&other) noexcept;
+    ModelLease(const ModelLease &) = delete;
+    ModelLease &operator=(const ModelLease &) = delete;
+    ~ModelLease();
+
+    bool isValid() const { return ctx && state; }
+    struct whisper_context *context() const { return ctx; }
+    struct whisper_state *whisperState() const { return state; }
+    bool wasResident() const { return hit; }
+    qint64 loadMs() const { return loadTimeMs; } // load, or wait for a preload, this lease paid for
+    QString error() const { return errorText; }  // why an invalid lease has no model
+
+    // a run with a shrunk audio_ctx leaves it in the state for encoders called directly
+    // (dual decoding, language detection), such a state is freed instead of kept as spare
+    void noteAudioCtx(int audioCtx) { if (audioCtx > 0) reusable = false; }
+
+    void release();
+
+private:
+    friend class ModelManager;
+    struct whisper_context *ctx = nullptr;
+    struct whisper_state *state = nullptr;
+    bool hit = false;
+    bool reusable = true;
+    qint64 loadTimeMs = 0;
+    QString errorText;
+};
+
+// Keeps whisper contexts loaded across jobs so alternating models (previews, language
+// routing, finals) do not reload each time. Concurrent jobs on one model share its weights
+// and decode with their own whisper_state. Idle models are evicted least recently used
+// first once the resident total passes the budget; models in use are never evicted, the
+// budget may be exceeded while they are.
+class ModelManager {
+public:
+    static ModelManager &instance();
+
+    void setBudgetBytes(qint64 bytes);
+
+    // invalid lease when the model cannot be loaded; waits for a preload of the same model
+    ModelLease acquire(const QString &path, bool useGpu);
+
+    // loads the model on a background thread and runs a short inference with warmupThreads
+    // so the first job finds the weights in memory and a state with its buffers touched
+    std::shared_future<bool> preload(const QString &path, bool useGpu, int warmupThreads);
+
+    ModelStats stats() const;
+
+    // the model is resident or being loaded, a job on it adds no weights
+    bool contains(const QString &path, bool useGpu) const;
+
+    // weights resident or being loaded, counted once however many jobs share them
+    qint64 committedBytes() const;
+
+    // frees every idle model
+    void clear();
+
+private:
+    ModelManager() = default;
+    ~ModelManager();
+
+    struct Entry {
+        QString path;
+        bool useGpu = false;
+        struct whisper_context *ctx = nullptr;
+        struct whisper_state *spare = nullptr; // kept for the next lease, warmed up by a preload
+        qint64 bytes = 0;
+        int users = 0;
+        bool loading = false;
+        quint64 lastUsed = 0;
+    };
+
+    Entry *insert(const QString &path, bool useGpu);
+    bool load(Entry *entry, int warmupThreads, QString *error); // with the mutex held, released while loading
+    static void warmUp(struct whisper_context *ctx, struct whisper_state *state, int threads);
+    void release(struct whisper_context *ctx, struct whisper_state *state, bool reusable);
+    void evict(qint64 incomingBytes);
+    Entry *find(const QString &path, bool useGpu) const;
+
+    mutable QMutex mutex;
+    QWaitCondition loaded;
+    QList<Entry *> entries;
+    qint64 budgetBytes = 3LL * 1024 * 1024 * 1024;
+    quint64 clock = 0;
+    ModelStats counters;
+    std::vector<std::thread> preloads;
+};
+
+#endif // MODELMANAGER_H
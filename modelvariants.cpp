@@ -0,0 +1,146 @@
+#include "modelvariants.h"
+
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QDebug>
+
+#if defined(WHISPER_QUANTIZE)
+#include "ggml.h"
+#include "common-ggml.h"
+
+#include <fstream>
+#include <string>
+#include <vector>
+#endif
+
+QStringList ModelVariants::supportedTypes() {
+    return QStringList() << "q4_0" << "q4_1" << "q5_0" << "q5_1" << "q8_0";
+}
+
+QString ModelVariants::variantPath(const QString &basePath, const QString &type) {
+    const QFileInfo info(basePath);
+    return info.path() + "/" + info.completeBaseName() + "-" + type + "." + info.suffix();
+}
+
+QStringList ModelVariants::available(const QString &basePath) {
+    QStringList types;
+    for (const auto &type : supportedTypes()) {
+        if (QFileInfo::exists(variantPath(basePath, type))) {
+            types.append(type);
+        }
+    }
+    return types;
+}
+
+QString ModelVariants::ensure(const QString &basePath, const QString &type) {
+    const QString path = variantPath(basePath, type);
+
+    // one quantization at a time, concurrent jobs asking for the same variant wait for it
+    static QMutex mutex;
+    QMutexLocker locker(&mutex);
+    if (QFileInfo::exists(path)) {
+        return path;
+    }
+    if (!supportedTypes().contains(type)) {
+        qWarning() << "model: unknown quantization type" << type;
+        return QString();
+    }
+
+    // written under a temporary name so a crash never leaves a truncated model behind
+    const QString part = path + ".part";
+    qInfo() << "model: quantizing" << basePath << "to" << type;
+    if (!quantize(basePath, part, type) || !QFile::rename(part, path)) {
+        QFile::remove(part);
+        return QString();
+    }
+    return path;
+}
+
+#if defined(WHISPER_QUANTIZE)
+// as whisper.cpp/examples/quantize: copy header, mel filters and vocabulary, then quantize the weights
+bool ModelVariants::quantize(const QString &input, const QString &output, const QString &type) {
+    const ggml_ftype ftype = ggml_parse_ftype(type.toLatin1().constData());
+    if (ftype == GGML_FTYPE_UNKNOWN) {
+        return false;
+    }
+
+    // initializes the f16 conversion tables used by the quantizers
+    {
+        struct ggml_init_params params = { 0, nullptr, false };
+        ggml_free(ggml_init(params));
+    }
+
+    std::ifstream finp(QFile::encodeName(input).constData(), std::ios::binary);
+    std::ofstream fout(QFile::encodeName(output).constData(), std::ios::binary);
+    if (!finp || !fout) {
+        return false;
+    }
+
+    uint32_t magic = 0;
+    finp.read((char *) &magic, sizeof(magic));
+    if (magic != GGML_FILE_MAGIC) {
+        qWarning() << "model: not a ggml model" << input;
+        return false;
+    }
+    fout.write((char *) &magic, sizeof(magic));
+
+    // n_vocab, n_audio_ctx, n_audio_state, n_audio_head, n_audio_layer,
+    // n_text_ctx, n_text_state, n_text_head, n_text_layer, n_mels, ftype
+    int32_t hparams[11];
+    finp.read((char *) hparams, sizeof(hparams));
+    const int32_t qntvr = hparams[10] / GGML_QNT_VERSION_FACTOR;
+    if (hparams[10] % GGML_QNT_VERSION_FACTOR != GGML_FTYPE_MOSTLY_F16 && hparams[10] % GGML_QNT_VERSION_FACTOR != GGML_FTYPE_ALL_F32) {
+        qWarning() << "model: already quantized, ftype" << hparams[10] << "version" << qntvr;
+        return false;
+    }
+    hparams[10] = GGML_QNT_VERSION * GGML_QNT_VERSION_FACTOR + ftype;
+    fout.write((char *) hparams, sizeof(hparams));
+
+    int32_t n_mel = 0;
+    int32_t n_fft = 0;
+    finp.read((char *) &n_mel, sizeof(n_mel));
+    finp.read((char *) &n_fft, sizeof(n_fft));
+    fout.write((char *) &n_mel, sizeof(n_mel));
+    fout.write((char *) &n_fft, sizeof(n_fft));
+    std::vector<float> filters(size_t(n_mel) * n_fft);
+    finp.read((char *) filters.data(), filters.size() * sizeof(float));
+    fout.write((char *) filters.data(), filters.size() * sizeof(float));
+
+    int32_t n_vocab = 0;
+    finp.read((char *) &n_vocab, sizeof(n_vocab));
+    fout.write((char *) &n_vocab, sizeof(n_vocab));
+    std::string word;
+    for (int i = 0; i < n_vocab && finp; i++) {
+        uint32_t len = 0;
+        finp.read((char *) &len, sizeof(len));
+        word.resize(len);
+        finp.read(&word[0], len);
+        fout.write((char *) &len, sizeof(len));
+        fout.write(word.data(), len);
+    }
+    if (!finp) {
+        return false;
+    }
+
+    // small tensors that lose too much precision
+    const std::vector<std::string> to_skip = {
+        "encoder.conv1.bias",
+        "encoder.conv2.bias",
+        "encoder.positional_embedding",
+        "decoder.positional_embedding",
+    };
+    if (!ggml_common_quantize_0(finp, fout, ftype, { ".*" }, to_skip)) {
+        return false;
+    }
+
+    fout.close();
+    return bool(fout);
+}
+#else
+bool ModelVariants::quantize(const QString &input, const QString & /*output*/, const QString &type) {
+    qWarning() << "model: built without WHISPER_QUANTIZE, cannot make" << type << "from" << input;
+    return false;
+}
+#endif
@@ -0,0 +1,25 @@
+#ifndef MODELVARIANTS_H
+#define MODELVARIANTS_H
+
+#include <QString>
+#include <QStringList>
+
+// Quantized variants of a ggml model (q5_0, q8_0, ...), named like whisper.cpp's own
+// downloads (ggml-medium.bin -> ggml-medium-q5_0.bin) and kept next to the original.
+class ModelVariants {
+public:
+    static QStringList supportedTypes();
+
+    static QString variantPath(const QString &basePath, const QString &type);
+
+    // types with a file next to the base model
+    static QStringList available(const QString &basePath);
+
+    // path of the variant, quantizing the base model first when it is missing; empty on failure
+    static QString ensure(const QString &basePath, const QString &type);
+
+private:
+    static bool quantize(const QString &input, const QString &output, const QString &type);
+};
+
+#endif // MODELVARIANTS_H
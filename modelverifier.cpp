@@ -0,0 +1,291 @@
+#include "modelverifier.h"
+#include "ggml.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QDebug>
+
+#include <cstring>
+#include <vector>
+
+namespace {
+
+// streaming XXH64, as specified at github.com/Cyan4973/xxHash
+class Xxh64 {
+public:
+    explicit Xxh64(quint64 seed = 0) {
+        v[0] = seed + kPrime1 + kPrime2;
+        v[1] = seed + kPrime2;
+        v[2] = seed;
+        v[3] = seed - kPrime1;
+    }
+
+    void update(const quint8 *data, size_t size) {
+        total += size;
+        if (bufferSize + size < 32) {
+            memcpy(buffer + bufferSize, data, size);
+            bufferSize += size;
+            return;
+        }
+        if (bufferSize > 0) {
+            const size_t fill = 32 - bufferSize;
+            memcpy(buffer + bufferSize, data, fill);
+            stripe(buffer);
+            data += fill;
+            size -= fill;
+            bufferSize = 0;
+        }
+        for (; size >= 32; data += 32, size -= 32) {
+            stripe(data);
+        }
+        memcpy(buffer, data, size);
+        bufferSize = size;
+    }
+
+    quint64 digest() const {
+        quint64 h;
+        if (total >= 32) {
+            h = rotl(v[0], 1) + rotl(v[1], 7) + rotl(v[2], 12) + rotl(v[3], 18);
+            for (int i = 0; i < 4; ++i) {
+                h = (h ^ round(0, v[i])) * kPrime1 + kPrime4;
+            }
+        } else {
+            h = v[2] + kPrime5;
+        }
+        h += total;
+
+        const quint8 *p = buffer;
+        size_t n = bufferSize;
+        for (; n >= 8; p += 8, n -= 8) {
+            h = rotl(h ^ round(0, read64(p)), 27) * kPrime1 + kPrime4;
+        }
+        if (n >= 4) {
+            h = rotl(h ^ (quint64(read32(p)) * kPrime1), 23) * kPrime2 + kPrime3;
+            p += 4;
+            n -= 4;
+        }
+        for (; n > 0; ++p, --n) {
+            h = rotl(h ^ (*p * kPrime5), 11) * kPrime1;
+        }
+
+        h ^= h >> 33;
+        h *= kPrime2;
+        h ^= h >> 29;
+        h *= kPrime3;
+        h ^= h >> 32;
+        return h;
+    }
+
+private:
+    static const quint64 kPrime1 = 0x9E3779B185EBCA87ULL;
+    static const quint64 kPrime2 = 0xC2B2AE3D27D4EB4FULL;
+    static const quint64 kPrime3 = 0x165667B19E3779F9ULL;
+    static const quint64 kPrime4 = 0x85EBCA77C2B2AE63ULL;
+    static const quint64 kPrime5 = 0x27D4EB2F165667C5ULL;
+
+    static quint64 rotl(quint64 x, int r) { return (x << r) | (x >> (64 - r)); }
+    static quint64 round(quint64 acc, quint64 input) { return rotl(acc + input * kPrime2, 31) * kPrime1; }
+    static quint64 read64(const quint8 *p) { quint64 x; memcpy(&x, p, 8); return x; } // little-endian hosts
+    static quint32 read32(const quint8 *p) { quint32 x; memcpy(&x, p, 4); return x; }
+
+    void stripe(const quint8 *p) {
+        for (int i = 0; i < 4; ++i) {
+            v[i] = round(v[i], read64(p + 8 * i));
+        }
+    }
+
+    quint64 v[4];
+    quint8 buffer[32];
+    size_t bufferSize = 0;
+    quint64 total = 0;
+};
+
+}
+
+static const qint64 kReadBytes = 8 * 1024 * 1024;
+
+quint64 ModelVerifier::digest(const QString &path, bool *ok) {
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        if (ok) {
+            *ok = false;
+        }
+        return 0;
+    }
+
+    Xxh64 hash;
+    std::vector<char> buffer(kReadBytes);
+    qint64 n = 0;
+    while ((n = file.read(buffer.data(), kReadBytes)) > 0) {
+        hash.update(reinterpret_cast<const quint8 *>(buffer.data()), size_t(n));
+    }
+    if (ok) {
+        *ok = n == 0;
+    }
+    return hash.digest();
+}
+
+QString ModelVerifier::checkStructure(QFile &file) {
+    const QString name = QFileInfo(file.fileName()).fileName();
+    const QString redownload = QString("Model %1 is damaged (%2), download it again").arg(name);
+
+    const qint64 size = file.size();
+
+    auto readInt = [&file](qint32 &value) {
+        return file.read(reinterpret_cast<char *>(&value), sizeof(value)) == sizeof(value);
+    };
+    auto skip = [&file, size](qint64 bytes) {
+        return bytes >= 0 && file.pos() + bytes <= size && file.seek(file.pos() + bytes);
+    };
+
+    qint32 magic = 0;
+    if (!readInt(magic) || quint32(magic) != GGML_FILE_MAGIC) {
+        return QString("%1 is not a whisper.cpp ggml model, download a ggml-*.bin model").arg(name);
+    }
+
+    // n_vocab, n_audio_ctx, n_audio_state, n_audio_head, n_audio_layer,
+    // n_text_ctx, n_text_state, n_text_head, n_text_layer, n_mels, ftype
+    qint32 hparams[11];
+    for (auto &value : hparams) {
+        if (!readInt(value)) {
+            return redownload.arg("header cut short");
+        }
+    }
+    const qint32 n_audio_layer = hparams[4];
+    const qint32 n_text_layer = hparams[8];
+    if (n_audio_layer <= 0 || n_audio_layer > 256 || n_text_layer <= 0 || n_text_layer > 256) {
+        return redownload.arg("implausible header");
+    }
+
+    qint32 n_mel = 0;
+    qint32 n_fft = 0;
+    if (!readInt(n_mel) || !readInt(n_fft) || n_mel <= 0 || n_fft <= 0 || !skip(qint64(n_mel) * n_fft * sizeof(float))) {
+        return redownload.arg("mel filters cut short");
+    }
+
+    qint32 n_vocab = 0;
+    if (!readInt(n_vocab) || n_vocab <= 0) {
+        return redownload.arg("vocabulary cut short");
+    }
+    for (qint32 i = 0; i < n_vocab; ++i) {
+        qint32 len = 0;
+        if (!readInt(len) || !skip(quint32(len))) {
+            return redownload.arg("vocabulary cut short");
+        }
+    }
+
+    // tensors follow back to back up to the end of the file
+    int n_tensors = 0;
+    while (file.pos() < size) {
+        qint32 n_dims = 0;
+        qint32 length = 0;
+        qint32 ttype = 0;
+        if (!readInt(n_dims) || !readInt(length) || !readInt(ttype)) {
+            return redownload.arg("tensor header cut short");
+        }
+        if (n_dims < 1 || n_dims > 4 || length <= 0 || length > 256 || ttype < 0 || ttype >= GGML_TYPE_COUNT
+            || ggml_blck_size(ggml_type(ttype)) <= 0) {
+            return redownload.arg(QString("bad tensor header at offset %1").arg(file.pos() - 12));
+        }
+        qint64 nelements = 1;
+        for (qint32 i = 0; i < n_dims; ++i) {
+            qint32 ne = 0;
+            if (!readInt(ne) || ne <= 0) {
+                return redownload.arg("tensor header cut short");
+            }
+            nelements *= ne;
+        }
+        const QByteArray tensor = file.read(length);
+        const qint64 bytes = nelements / ggml_blck_size(ggml_type(ttype)) * qint64(ggml_type_size(ggml_type(ttype)));
+        if (tensor.size() != length || !skip(bytes)) {
+            return redownload.arg(QString("file ends inside tensor %1, %2 MB").arg(QString::fromLatin1(tensor)).arg(size >> 20));
+        }
+        n_tensors++;
+    }
+
+    // encoder: 7 plus 15 per layer, decoder: 4 plus 24 per layer, as whisper.cpp loads them
+    const int expected = 7 + 15 * n_audio_layer + 4 + 24 * n_text_layer;
+    if (n_tensors != expected) {
+        return redownload.arg(QString("%1 of %2 tensors").arg(n_tensors).arg(expected));
+    }
+    return QString();
+}
+
+bool ModelVerifier::melFilters(const QString &path, int &n_mel, int &n_fft, std::vector<float> &filters) {
+    QFile file(path);
+    qint32 magic = 0;
+    if (!file.open(QIODevice::ReadOnly) || file.read(reinterpret_cast<char *>(&magic), sizeof(magic)) != sizeof(magic)
+        || quint32(magic) != GGML_FILE_MAGIC) {
+        return false;
+    }
+    // magic, then the 11 hyperparameters, then n_mel, n_fft and the filters
+    qint32 dims[2] = { 0, 0 };
+    if (!file.seek(sizeof(qint32) * 12) || file.read(reinterpret_cast<char *>(dims), sizeof(dims)) != sizeof(dims)
+        || dims[0] <= 0 || dims[0] > 512 || dims[1] <= 0 || dims[1] > 4096) {
+        return false;
+    }
+    n_mel = dims[0];
+    n_fft = dims[1];
+    filters.resize(size_t(n_mel) * n_fft);
+    const qint64 bytes = qint64(filters.size() * sizeof(float));
+    return file.read(reinterpret_cast<char *>(filters.data()), bytes) == bytes;
+}
+
+QString ModelVerifier::verify(const QString &path) {
+    const QFileInfo info(path);
+    if (!info.exists()) {
+        return QString("Model %1 not found, put it into %2").arg(info.fileName(), info.absolutePath());
+    }
+
+    // a published digest next to the model, e.g. ggml-medium.bin.xxh64, part of the cached verdict
+    QString want;
+    QFile expected(path + ".xxh64");
+    if (expected.open(QIODevice::ReadOnly)) {
+        want = QString::fromLatin1(expected.readAll()).section(' ', 0, 0).trimmed().toLower();
+    }
+
+    QSettings settings("ImproveYourMix", "VideoTranscriber");
+    const QByteArray id = QCryptographicHash::hash(info.absoluteFilePath().toUtf8(), QCryptographicHash::Sha1).toHex();
+    settings.beginGroup("models/" + QString::fromLatin1(id));
+    const qint64 mtime = info.lastModified().toMSecsSinceEpoch();
+    if (settings.value("size").toLongLong() == info.size() && settings.value("mtime").toLongLong() == mtime
+        && settings.value("expected").toString() == want && settings.contains("error")) {
+        return settings.value("error").toString();
+    }
+
+    // read errors (a lock held by a virus scanner, a flaky share) are not a verdict on the file
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString("Cannot read model %1: %2").arg(info.fileName(), file.errorString());
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+    QString error = checkStructure(file);
+    file.close();
+    QString hex;
+    if (error.isEmpty()) {
+        // reads the whole file once, which also leaves it in the page cache for the load that follows
+        bool ok = false;
+        hex = QString("%1").arg(digest(path, &ok), 16, 16, QLatin1Char('0'));
+        if (!ok) {
+            return QString("Cannot read model %1").arg(info.fileName());
+        }
+        if (!want.isEmpty() && want != hex) {
+            error = QString("Model %1 does not match its digest (%2, expected %3), download it again").arg(info.fileName(), hex, want);
+        }
+    }
+    qInfo("model: verified %s in %lld ms, xxh64 %s%s", qPrintable(info.fileName()), (long long) timer.elapsed(), qPrintable(hex),
+          error.isEmpty() ? "" : qPrintable(", " + error));
+
+    settings.setValue("size", info.size());
+    settings.setValue("mtime", mtime);
+    settings.setValue("expected", want);
+    settings.setValue("digest", hex);
+    settings.setValue("error", error);
+    return error;
+}
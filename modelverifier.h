@@ -0,0 +1,30 @@
+#ifndef MODELVERIFIER_H
+#define MODELVERIFIER_H
+
+#include <QString>
+#include <vector>
+
+class QFile;
+
+// Checks a ggml model before whisper spends seconds loading it: the header, vocabulary
+// and every tensor header are walked with seeks, so truncation shows up at once, and the
+// content is hashed with XXH64 in large sequential reads. The outcome is remembered per
+// file size, modification time and expected digest, an unchanged model is not read again;
+// read errors are not remembered.
+class ModelVerifier {
+public:
+    // empty when the model is usable, otherwise what is wrong and what to do about it
+    static QString verify(const QString &path);
+
+    // XXH64 of the whole file, 0 with ok false when it cannot be read
+    static quint64 digest(const QString &path, bool *ok = nullptr);
+
+    // the [n_mel][n_fft] mel filterbank from the model header, false when it cannot be read
+    static bool melFilters(const QString &path, int &n_mel, int &n_fft, std::vector<float> &filters);
+
+private:
+    // walks the headers of an open model file
+    static QString checkStructure(QFile &file);
+};
+
+#endif // MODELVERIFIER_H
@@ -0,0 +1,156 @@
+#include "nodeagent.h"
+#include "hardwareinfo.h"
+#include "workerpool.h"
+#include "workerprotocol.h"
+
+#include <QCoreApplication>
+#include <QDir>
+#include <QJsonArray>
+#include <QDebug>
+
+NodeAgent::NodeAgent(const QString &host, quint16 port, int capacity, const QStringList &roots, const whisper_params &params, QObject *parent)
+    : QObject(parent), host(host), port(port), capacity(qMax(1, capacity)), params(params) {
+    for (const auto &root : roots) {
+        this->roots.append(QDir(root).absolutePath());
+    }
+    // several nodes may share a machine, tell them apart by process
+    name = QString("%1/%2").arg(HardwareInfo::hostId()).arg(QCoreApplication::applicationPid());
+
+    connect(&socket, &QTcpSocket::connected, this, &NodeAgent::onConnected);
+    connect(&socket, &QTcpSocket::disconnected, this, &NodeAgent::onDisconnected);
+    connect(&socket, &QTcpSocket::readyRead, this, &NodeAgent::onReadyRead);
+    connect(&socket, &QTcpSocket::errorOccurred, this, [this]() {
+        if (socket.state() != QAbstractSocket::ConnectedState) {
+            reconnect.start();
+        }
+    });
+    connect(&heartbeat, &QTimer::timeout, this, &NodeAgent::sendHeartbeat);
+    reconnect.setSingleShot(true);
+    reconnect.setInterval(2000);
+    connect(&reconnect, &QTimer::timeout, this, &NodeAgent::start);
+}
+
+void NodeAgent::start() {
+    if (!pool) {
+        pool = new WorkerPool(capacity, params, this);
+        connect(pool, &WorkerPool::progressUpdated, this, [this](qint64 job, int progress) {
+            if (assignments.contains(job)) {
+                assignments[job].progress = progress;
+            }
+        });
+        connect(pool, &WorkerPool::statusUpdated, this, [this](qint64 job, int clip, const QString &status) {
+            if (clip < 0 && assignments.contains(job)) {
+                assignments[job].lastStatus = status;
+            }
+        });
+        connect(pool, &WorkerPool::outputWritten, this, [this](qint64 job, int clip, const QString & /*file*/) {
+            if (clip < 0 && assignments.contains(job)) {
+                assignments[job].wroteOutput = true;
+            }
+        });
+        connect(pool, &WorkerPool::jobFinished, this, &NodeAgent::onJobFinished);
+    }
+    buffer.clear();
+    socket.abort();
+    socket.connectToHost(host, port);
+}
+
+void NodeAgent::setToken(const QString &token) {
+    this->token = token;
+}
+
+void NodeAgent::onConnected() {
+    QJsonObject message;
+    message["type"] = "register";
+    message["token"] = token;
+    message["name"] = name;
+    message["slots"] = capacity;
+    message["roots"] = QJsonArray::fromStringList(roots);
+    send(message);
+    qInfo() << "node: connected to" << host << port << "as" << name;
+}
+
+void NodeAgent::onDisconnected() {
+    heartbeat.stop();
+    if (!assignments.isEmpty()) {
+        qWarning("node: lost the coordinator, abandoning %d job(s)", int(assignments.size()));
+        for (auto it = assignments.constBegin(); it != assignments.constEnd(); ++it) {
+            pool->abort(it.key());
+        }
+    }
+    reconnect.start();
+}
+
+void NodeAgent::onReadyRead() {
+    buffer.append(socket.readAll());
+    QJsonObject message;
+    while (WorkerProtocol::next(buffer, message)) {
+        onMessage(message);
+    }
+}
+
+void NodeAgent::onMessage(const QJsonObject &message) {
+    const QString type = message["type"].toString();
+    if (type == "registered") {
+        heartbeat.start(message["heartbeatMs"].toInt(2000));
+    } else if (type == "job") {
+        // the coordinator decides what to run, this machine how to run it
+        whisper_params jobParams = WorkerProtocol::paramsFromJson(message["params"].toObject());
+        jobParams.n_threads = params.n_threads;
+        jobParams.use_gpu = params.use_gpu;
+
+        WorkerJob job;
+        job.file = message["file"].toString();
+        job.outputFolder = message["output"].toString();
+        job.params = jobParams;
+
+        Assignment assignment;
+        assignment.id = qint64(message["id"].toDouble());
+        assignment.lease = qint64(message["lease"].toDouble());
+        assignments.insert(pool->submit(job), assignment);
+        qInfo() << "node: job" << assignment.id << job.file;
+    } else if (type == "cancel") {
+        const qint64 id = qint64(message["id"].toDouble());
+        for (auto it = assignments.constBegin(); it != assignments.constEnd(); ++it) {
+            if (it.value().id == id) {
+                pool->abort(it.key());
+            }
+        }
+    }
+}
+
+void NodeAgent::onJobFinished(qint64 poolJob, bool aborted) {
+    if (!assignments.contains(poolJob)) {
+        return;
+    }
+    const Assignment assignment = assignments.take(poolJob);
+    if (socket.state() != QAbstractSocket::ConnectedState) {
+        return;
+    }
+    QJsonObject message;
+    message["type"] = "finished";
+    message["id"] = assignment.id;
+    message["lease"] = assignment.lease;
+    message["ok"] = assignment.wroteOutput && !aborted;
+    message["error"] = aborted ? QString("aborted") : assignment.lastStatus;
+    send(message);
+}
+
+void NodeAgent::sendHeartbeat() {
+    QJsonArray jobs;
+    for (const auto &assignment : assignments) {
+        QJsonObject held;
+        held["id"] = assignment.id;
+        held["lease"] = assignment.lease;
+        held["progress"] = assignment.progress;
+        jobs.append(held);
+    }
+    QJsonObject message;
+    message["type"] = "heartbeat";
+    message["jobs"] = jobs;
+    send(message);
+}
+
+void NodeAgent::send(const QJsonObject &message) {
+    socket.write(WorkerProtocol::frame(message));
+}
@@ -0,0 +1,64 @@
+#ifndef NODEAGENT_H
+#define NODEAGENT_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QJsonObject>
+#include <QObject>
+#include <QStringList>
+#include <QTcpSocket>
+#include <QTimer>
+#include "transcriber.h"
+
+class WorkerPool;
+
+// A transcription machine serving a Coordinator (--node host:port). Registers its slot count
+// and local directories, runs the jobs it is leased in worker processes and reports progress
+// in heartbeats. Reconnects when the coordinator goes away, abandoning the jobs it held since
+// the coordinator has already put them back in the queue.
+class NodeAgent : public QObject {
+    Q_OBJECT
+
+public:
+    // params supply the host specific settings (threads, GPU) and the model to preload
+    NodeAgent(const QString &host, quint16 port, int capacity, const QStringList &roots, const whisper_params &params, QObject *parent = nullptr);
+
+    void start();
+
+    // presented to the coordinator on registration
+    void setToken(const QString &token);
+
+private:
+    struct Assignment {
+        qint64 id = 0;      // coordinator job id
+        qint64 lease = 0;
+        int progress = 0;
+        bool wroteOutput = false;
+        QString lastStatus;
+    };
+
+    void onConnected();
+    void onDisconnected();
+    void onReadyRead();
+    void onMessage(const QJsonObject &message);
+    void onJobFinished(qint64 poolJob, bool aborted);
+    void sendHeartbeat();
+    void send(const QJsonObject &message);
+
+    QString host;
+    quint16 port;
+    int capacity;
+    QStringList roots;
+    whisper_params params;
+    QString name;
+    QString token;
+
+    QTcpSocket socket;
+    QByteArray buffer;
+    QTimer heartbeat;
+    QTimer reconnect;
+    WorkerPool *pool = nullptr;
+    QHash<qint64, Assignment> assignments; // by pool job id
+};
+
+#endif // NODEAGENT_H
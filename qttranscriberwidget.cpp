@@ -1,11 +1,17 @@
 #include "qttranscriberwidget.h"
 #include "ui_qttranscriberwidget.h"
+#include "modelvariants.h"
 
 #include <QFileDialog>
 #include <QMessageBox>
 #include <QTimer>
 #include <QFileInfo>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QSettings>
 
+static const char *kDeadlineFormat = "yyyy-MM-dd HH:mm";
 
 QtTranscriberWidget::QtTranscriberWidget(QWidget *parent)
     : QWidget(parent), ui(new Ui::QtTranscriberWidget), model(new TranscriptionModel(this)), threadQueueManager(new TranscriptionQueueManager(this)) {
@@ -16,8 +22,8 @@ QtTranscriberWidget::QtTranscriberWidget(QWidget *parent)
     connect(ui->pushButton_3, &QPushButton::clicked, this, &QtTranscriberWidget::transcribeFiles);
     connect(ui->pushButton_4, &QPushButton::clicked, this, &QtTranscriberWidget::stopCurrentTranscription);
 
-    model->setColumnCount(5); // Aggiungere colonne per il titolo e il link
-    model->setHorizontalHeaderLabels(QStringList() << "File" << "Title" << "Link" << "Progress" << "Status");
+    model->setColumnCount(9); // Aggiungere colonne per il titolo e il link
+    model->setHorizontalHeaderLabels(QStringList() << "File" << "Title" << "Link" << "Progress" << "Status" << "Preview" << "Model" << "Priority" << "Deadline");
     ui->tableView->setModel(model);
     ui->tableView->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
     ui->progressBar->setValue(0);
@@ -34,6 +40,108 @@ QtTranscriberWidget::QtTranscriberWidget(QWidget *parent)
     connect(threadQueueManager, &TranscriptionQueueManager::progressUpdated, this, &QtTranscriberWidget::onProgressUpdated);
     connect(threadQueueManager, &TranscriptionQueueManager::statusUpdated, this, &QtTranscriberWidget::onStatusUpdated);
     connect(threadQueueManager, &TranscriptionQueueManager::progressUpdated, this, &QtTranscriberWidget::updateTotalProgress);
+    connect(threadQueueManager, &TranscriptionQueueManager::previewReady, this, &QtTranscriberWidget::onPreviewReady);
+
+    // options without a control of their own, documented in the README
+    applySettings();
+
+    // loads while files are being picked, the first job then starts on a warm model (workers load their own)
+    if (!workerProcesses) {
+        Transcriber::preloadModels(threadQueueManager->getParams());
+    }
+
+    // pick up a batch interrupted by a crash or restart where it left off
+    threadQueueManager->enableJournal();
+    restoreJobs();
+}
+
+void QtTranscriberWidget::applySettings() {
+    QSettings settings("ImproveYourMix", "VideoTranscriber");
+    whisper_params params = threadQueueManager->getParams();
+
+    // order of the queue among files of equal priority: fifo, longest or shortest first
+    const QString policy = settings.value("queue/schedulingPolicy", "fifo").toString();
+    threadQueueManager->setSchedulingPolicy(policy == "longest" ? TranscriptionQueueManager::LongestFirst
+                                            : policy == "shortest" ? TranscriptionQueueManager::ShortestFirst
+                                                                   : TranscriptionQueueManager::Fifo);
+
+    // each running job on cores of its own, on one node of NUMA machines
+    threadQueueManager->setPinWorkers(settings.value("queue/pinWorkers", false).toBool());
+
+    // short clips decoded together in one 30 s window
+    threadQueueManager->setClipPacking(settings.value("queue/clipPacking", false).toBool(),
+                                       settings.value("queue/maxPackedClipMs", 10000).toLongLong());
+
+    // jobs in child processes keep a crash in one file from taking the window and queue down
+    workerProcesses = settings.value("queue/workerProcesses", false).toBool();
+    threadQueueManager->setWorkerProcesses(workerProcesses);
+
+    // language pre-pass, and the model each detected language is transcribed with
+    params.language = settings.value("transcription/language", QString::fromStdString(params.language)).toString().toStdString();
+    params.detect_language = settings.value("transcription/detectLanguage", params.detect_language).toBool();
+    params.detect_model = settings.value("transcription/detectModel", QString::fromStdString(params.detect_model)).toString().toStdString();
+    settings.beginGroup("transcription/languageModels");
+    for (const auto &language : settings.childKeys()) {
+        params.language_models[language.toStdString()] = settings.value(language).toString().toStdString();
+    }
+    settings.endGroup();
+
+    // greedy is fastest; beam searches throughout, adaptive only where greedy is unsure
+    const QString decoding = settings.value("transcription/decoding", "greedy").toString();
+    if (!Transcriber::setDecoding(params, decoding)) {
+        qWarning() << "settings: unknown transcription/decoding" << decoding << "- using greedy";
+        Transcriber::setDecoding(params, "greedy");
+    }
+    params.beam_size = qMax(1, settings.value("transcription/beamSize", params.beam_size).toInt());
+
+    // an English translation next to every transcript from the same encoder pass
+    params.dual_output = settings.value("transcription/dualOutput", params.dual_output).toBool();
+
+    // a quick draft from a small model shown in the Preview column while the full job runs
+    params.preview_model = settings.value("transcription/previewModel", QString::fromStdString(params.preview_model)).toString().toStdString();
+
+    // per-token data needs token timestamps, which keep the mel cache from being used
+    params.output_jsn_full = settings.value("transcription/fullJson", params.output_jsn_full).toBool();
+
+    // re-runs of a file skip the spectrogram
+    params.mel_cache = settings.value("transcription/melCache", params.mel_cache).toBool();
+    params.mel_cache_mb = settings.value("transcription/melCacheMb", params.mel_cache_mb).toInt();
+
+    threadQueueManager->setParams(params);
+}
+
+void QtTranscriberWidget::restoreJobs() {
+    const QVector<JournalJob> jobs = threadQueueManager->restoreJournal();
+    if (jobs.isEmpty()) {
+        return;
+    }
+
+    selectedFiles.clear();
+    model->setRowCount(jobs.size());
+    for (int i = 0; i < jobs.size(); ++i) {
+        const JournalJob &job = jobs.at(i);
+        selectedFiles.append(job.file);
+        model->setItem(i, 0, new QStandardItem(job.file));
+        model->setItem(i, 1, new QStandardItem(job.title));
+        model->setItem(i, 2, new QStandardItem(job.link));
+        model->setItem(i, 3, new QStandardItem("0%"));
+        model->setItem(i, 4, new QStandardItem(job.started ? QString("Restarting (was at %1%)").arg(job.progress) : "Restored"));
+        model->setItem(i, 5, new QStandardItem(""));
+        model->setItem(i, 6, new QStandardItem(job.modelVariant));
+        model->setItem(i, 7, new QStandardItem(QString::number(job.priority)));
+        model->setItem(i, 8, new QStandardItem(job.deadline.isValid() ? job.deadline.toString(kDeadlineFormat) : QString()));
+        progressMap[i] = 0;
+    }
+    outputFolder = jobs.first().outputFolder;
+    ui->pushButton_2->setText(outputFolder);
+
+    startTime = QTime::currentTime();
+    timer->start(1000);
+    threadQueueManager->start();
+    ui->pushButton_3->setText("Stop All");
+    ui->pushButton_3->setDisabled(false);
+    ui->pushButton_4->setDisabled(false);
+    isTranscribing = true;
 }
 
 QtTranscriberWidget::~QtTranscriberWidget() {
@@ -41,7 +149,7 @@ QtTranscriberWidget::~QtTranscriberWidget() {
 }
 
 void QtTranscriberWidget::selectFiles() {
-    selectedFiles = QFileDialog::getOpenFileNames(this, tr("Select Audio or Video Files"), "", tr("Media Files (*.wav *.mp4)"));
+    selectedFiles = QFileDialog::getOpenFileNames(this, tr("Select Audio or Video Files"), "", tr("Media Files (*.wav *.mp4 *.mov *.m4a *.mkv *.webm *.mp3 *.flac *.ogg)"));
     model->setRowCount(selectedFiles.size());
 
     for (int i = 0; i < selectedFiles.size(); ++i) {
@@ -50,12 +158,27 @@ void QtTranscriberWidget::selectFiles() {
         QStandardItem *linkItem = new QStandardItem("");
         QStandardItem *progressItem = new QStandardItem("0%");
         QStandardItem *statusItem = new QStandardItem("Waiting");
+        QStandardItem *previewItem = new QStandardItem("");
 
         model->setItem(i, 0, fileItem);
         model->setItem(i, 1, titleItem);
         model->setItem(i, 2, linkItem);
         model->setItem(i, 3, progressItem);
         model->setItem(i, 4, statusItem);
+        model->setItem(i, 5, previewItem);
+
+        // f16, or a quantized variant such as q5_0 or q8_0
+        QStandardItem *modelItem = new QStandardItem(QString::fromStdString(threadQueueManager->getParams().model_variant));
+        modelItem->setToolTip("f16, " + ModelVariants::supportedTypes().join(", "));
+        model->setItem(i, 6, modelItem);
+
+        // higher runs first; a deadline puts the file ahead of everything without one
+        QStandardItem *priorityItem = new QStandardItem("0");
+        priorityItem->setToolTip("Higher numbers run first");
+        model->setItem(i, 7, priorityItem);
+        QStandardItem *deadlineItem = new QStandardItem("");
+        deadlineItem->setToolTip(QString("Finish by, as %1; earliest deadline runs first").arg(QLatin1String(kDeadlineFormat)));
+        model->setItem(i, 8, deadlineItem);
 
         progressMap[i] = 0; // Initialize progress map
     }
@@ -92,7 +215,10 @@ void QtTranscriberWidget::transcribeFiles() {
         // Ottieni titolo e link dalla tabella
         QString title = model->item(i, 1)->text();
         QString link = model->item(i, 2)->text();
-        threadQueueManager->addTranscription(selectedFiles.at(i), outputFolder, i, title, link);
+        QString variant = model->item(i, 6)->text().trimmed();
+        const int priority = model->item(i, 7)->text().trimmed().toInt();
+        const QDateTime deadline = QDateTime::fromString(model->item(i, 8)->text().trimmed(), kDeadlineFormat);
+        threadQueueManager->addTranscription(selectedFiles.at(i), outputFolder, i, title, link, priority, deadline, variant);
     }
 
     threadQueueManager->start();
@@ -139,6 +265,16 @@ void QtTranscriberWidget::onStatusUpdated(int row, const QString &status) {
     model->item(row, 4)->setText(status);
 }
 
+void QtTranscriberWidget::onPreviewReady(int row, const QString &file) {
+    QFile json(file);
+    if (!json.open(QIODevice::ReadOnly)) {
+        return;
+    }
+    const QString text = QJsonDocument::fromJson(json.readAll()).object().value("videoText").toString().trimmed();
+    model->item(row, 5)->setText(text.left(200));
+    model->item(row, 5)->setToolTip(text);
+}
+
 void QtTranscriberWidget::updateTotalProgress() {
     int totalProgress = 0;
     for (auto progress : progressMap.values()) {
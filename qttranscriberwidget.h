@@ -29,9 +29,13 @@ private slots:
     void onAllThreadsFinished();
     void onProgressUpdated(int row, int progress);
     void onStatusUpdated(int row, const QString &status);
+    void onPreviewReady(int row, const QString &file);
     void updateTotalProgress();
 
 private:
+    void applySettings();
+    void restoreJobs();
+
     Ui::QtTranscriberWidget *ui;
     QStringList selectedFiles;
     QString outputFolder;
@@ -41,6 +45,7 @@ private:
     QTime startTime;
     TranscriptionQueueManager *threadQueueManager;
     bool isTranscribing = false;
+    bool workerProcesses = false;
     QMap<int, int> progressMap;
 };
 
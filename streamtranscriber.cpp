@@ -0,0 +1,201 @@
+#include "streamtranscriber.h"
+#include "common.h"
+#include "modelmanager.h"
+
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+
+#include <cstring>
+
+#ifdef _WIN32
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+StreamTranscriber::StreamTranscriber(const whisper_params &params, int stepMs, int lengthMs, int keepMs)
+    : params(params), stepMs(stepMs), lengthMs(qMax(lengthMs, stepMs)), keepMs(qMin(keepMs, stepMs)) {}
+
+void StreamTranscriber::setEmitPartial(bool enabled) {
+    emitPartial = enabled;
+}
+
+bool StreamTranscriber::openInput(const QString &input) {
+    if (input == "-") {
+        #ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+        #endif
+        in = stdin;
+    } else {
+        in = fopen(input.toLocal8Bit().constData(), "rb");
+    }
+    return in != nullptr;
+}
+
+// consumes a leading WAV header if present, raw PCM is pushed back untouched
+bool StreamTranscriber::skipWavHeader() {
+    uint8_t riff[12];
+    const size_t n = fread(riff, 1, sizeof(riff), in);
+    if (n < sizeof(riff) || memcmp(riff, "RIFF", 4) != 0 || memcmp(riff + 8, "WAVE", 4) != 0) {
+        // not a WAV: keep the bytes as the first samples
+        pcm16.assign((n + 1) / 2, 0);
+        memcpy(pcm16.data(), riff, n);
+        return true;
+    }
+
+    while (true) {
+        uint8_t chunk[8];
+        if (fread(chunk, 1, sizeof(chunk), in) != sizeof(chunk)) {
+            return false;
+        }
+        const uint32_t size = chunk[4] | (chunk[5] << 8) | (chunk[6] << 16) | (uint32_t(chunk[7]) << 24);
+        if (memcmp(chunk, "data", 4) == 0) {
+            return true;
+        }
+
+        std::vector<uint8_t> body(size + (size & 1));
+        if (fread(body.data(), 1, body.size(), in) != body.size()) {
+            return false;
+        }
+        if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+            const uint16_t format = body[0] | (body[1] << 8);
+            channels = body[2] | (body[3] << 8);
+            const uint32_t sampleRate = body[4] | (body[5] << 8) | (body[6] << 16) | (uint32_t(body[7]) << 24);
+            const uint16_t bits = body[14] | (body[15] << 8);
+            if (format != 1 || bits != 16 || sampleRate != COMMON_SAMPLE_RATE || (channels != 1 && channels != 2)) {
+                fprintf(stderr, "%s: stream must be 16-bit PCM at %d Hz, mono or stereo\n", __func__, COMMON_SAMPLE_RATE);
+                return false;
+            }
+        }
+    }
+}
+
+size_t StreamTranscriber::readSamples(float *out, size_t n) {
+    // samples left over from header sniffing come first
+    size_t have = pcm16.size();
+    pcm16.resize(n * channels);
+    if (have < pcm16.size()) {
+        have += fread(pcm16.data() + have, sizeof(int16_t), pcm16.size() - have, in);
+    }
+
+    const size_t frames = have / channels;
+    for (size_t i = 0; i < frames; i++) {
+        out[i] = channels == 1 ? float(pcm16[i])/32768.0f : float(pcm16[2*i] + pcm16[2*i + 1])/65536.0f;
+    }
+    pcm16.clear();
+    return frames;
+}
+
+void StreamTranscriber::emitSegments(struct whisper_state *state, int64_t windowOffsetMs, int64_t skipBeforeMs, bool final) {
+    const int n_segments = whisper_full_n_segments_from_state(state);
+    for (int i = 0; i < n_segments; ++i) {
+        const int64_t t0 = whisper_full_get_segment_t0_from_state(state, i) * 10;
+        const int64_t t1 = whisper_full_get_segment_t1_from_state(state, i) * 10;
+        if (t1 <= skipBeforeMs) {
+            // already emitted as part of the previous window's overlap
+            continue;
+        }
+
+        QJsonObject segment;
+        segment["t0"] = qint64(windowOffsetMs + t0);
+        segment["t1"] = qint64(windowOffsetMs + t1);
+        segment["text"] = QString::fromUtf8(whisper_full_get_segment_text_from_state(state, i));
+        segment["final"] = final;
+        printf("%s\n", QJsonDocument(segment).toJson(QJsonDocument::Compact).constData());
+
+        if (final) {
+            const int n_tokens = whisper_full_n_tokens_from_state(state, i);
+            for (int j = 0; j < n_tokens; ++j) {
+                promptTokens.push_back(whisper_full_get_token_id_from_state(state, i, j));
+            }
+        }
+    }
+    fflush(stdout);
+}
+
+int StreamTranscriber::run(const QString &input) {
+    if (!openInput(input) || !skipWavHeader()) {
+        fprintf(stderr, "%s: failed to open stream '%s'\n", __func__, input.toLocal8Bit().constData());
+        return 1;
+    }
+
+    // verified and loaded like any job, waits for the preload started before the stream opened
+    ModelManager::instance().setBudgetBytes(qint64(params.model_cache_mb) * 1024 * 1024);
+    ModelLease model = ModelManager::instance().acquire(Transcriber::modelPath(params), params.use_gpu);
+    if (!model.isValid()) {
+        fprintf(stderr, "%s: %s\n", __func__, model.error().toLocal8Bit().constData());
+        return 1;
+    }
+    struct whisper_context *ctx = model.context();
+    struct whisper_state *state = model.whisperState();
+
+    const size_t n_samples_step = size_t(stepMs) * COMMON_SAMPLE_RATE / 1000;
+    const size_t n_samples_len  = size_t(lengthMs) * COMMON_SAMPLE_RATE / 1000;
+    const size_t n_samples_keep = size_t(keepMs) * COMMON_SAMPLE_RATE / 1000;
+    const size_t n_prompt_max   = size_t(whisper_n_text_ctx(ctx) / 2);
+
+    // fixed capacity: overlap kept from the previous window plus one full window
+    std::vector<float> window;
+    window.reserve(n_samples_keep + n_samples_len);
+    int64_t windowOffsetMs = 0;
+    int64_t overlapMs = 0;
+    bool eof = false;
+
+    while (!eof) {
+        const size_t before = window.size();
+        const size_t want = qMin(n_samples_step, n_samples_keep + n_samples_len - before);
+        window.resize(before + want);
+        const size_t got = readSamples(window.data() + before, want);
+        window.resize(before + got);
+        eof = got < want;
+
+        const bool final = eof || window.size() >= n_samples_keep + n_samples_len;
+        if (!final && !emitPartial) {
+            continue;
+        }
+        if (window.size() <= n_samples_keep) {
+            break;
+        }
+
+        whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+        wparams.print_progress   = false;
+        wparams.print_realtime   = false;
+        wparams.print_timestamps = false;
+        wparams.translate        = params.translate;
+        wparams.language         = params.language.c_str();
+        wparams.n_threads        = params.n_threads;
+        wparams.audio_ctx        = Transcriber::audioCtxFor(ctx, window.size(), params);
+        wparams.no_context       = true;
+        wparams.single_segment   = false;
+        wparams.prompt_tokens    = promptTokens.empty() ? nullptr : promptTokens.data();
+        wparams.prompt_n_tokens  = promptTokens.size();
+        model.noteAudioCtx(wparams.audio_ctx);
+
+        if (whisper_full_with_state(ctx, state, wparams, window.data(), window.size()) != 0) {
+            fprintf(stderr, "%s: failed to process audio\n", __func__);
+            return 1;
+        }
+
+        if (!final) {
+            emitSegments(state, windowOffsetMs, overlapMs, false);
+            continue;
+        }
+
+        emitSegments(state, windowOffsetMs, overlapMs, true);
+        if (promptTokens.size() > n_prompt_max) {
+            promptTokens.erase(promptTokens.begin(), promptTokens.end() - n_prompt_max);
+        }
+
+        // slide: only the overlap survives into the next window
+        const size_t keep = qMin(n_samples_keep, window.size());
+        windowOffsetMs += int64_t(window.size() - keep) * 1000 / COMMON_SAMPLE_RATE;
+        overlapMs = int64_t(keep) * 1000 / COMMON_SAMPLE_RATE;
+        std::copy(window.end() - keep, window.end(), window.begin());
+        window.resize(keep);
+    }
+
+    if (in && in != stdin) {
+        fclose(in);
+    }
+    return 0;
+}
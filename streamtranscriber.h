@@ -0,0 +1,40 @@
+#ifndef STREAMTRANSCRIBER_H
+#define STREAMTRANSCRIBER_H
+
+#include <QString>
+#include <cstdio>
+#include <vector>
+#include "transcriber.h"
+
+// Transcribes an unbounded PCM stream (stdin or a pipe) with a rolling window.
+// Input is raw 16 kHz s16le mono, or a WAV header followed by such data.
+// Finalized segments are written to stdout as JSON lines, memory stays constant.
+class StreamTranscriber {
+public:
+    StreamTranscriber(const whisper_params &params, int stepMs = 3000, int lengthMs = 10000, int keepMs = 200);
+
+    // "-" reads stdin, anything else is opened as a file or named pipe
+    int run(const QString &input);
+
+    // also print the not yet final hypothesis after every step
+    void setEmitPartial(bool enabled);
+
+private:
+    bool openInput(const QString &input);
+    bool skipWavHeader();
+    size_t readSamples(float *out, size_t n);
+    void emitSegments(struct whisper_state *state, int64_t windowOffsetMs, int64_t skipBeforeMs, bool final);
+
+    whisper_params params;
+    int stepMs;
+    int lengthMs;
+    int keepMs;
+    bool emitPartial = false;
+
+    FILE *in = nullptr;
+    int channels = 1;
+    std::vector<int16_t> pcm16;             // reused read buffer
+    std::vector<whisper_token> promptTokens; // carried over between windows
+};
+
+#endif // STREAMTRANSCRIBER_H
@@ -0,0 +1,150 @@
+// Checks the bit-parallel edit_distance and similarity in common.cpp against a plain
+// dynamic programming Levenshtein: random sequences up to several 64-symbol blocks long,
+// multi-byte and invalid UTF-8.
+
+#include "common.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); failures++; } } while (0)
+
+static int reference_distance(const std::vector<uint32_t> & a, const std::vector<uint32_t> & b) {
+    std::vector<int> row(b.size() + 1);
+    for (size_t j = 0; j <= b.size(); j++) {
+        row[j] = int(j);
+    }
+    for (size_t i = 1; i <= a.size(); i++) {
+        int diag = row[0];
+        row[0] = int(i);
+        for (size_t j = 1; j <= b.size(); j++) {
+            const int up = row[j];
+            row[j] = std::min({ row[j] + 1, row[j - 1] + 1, diag + (a[i - 1] == b[j - 1] ? 0 : 1) });
+            diag = up;
+        }
+    }
+    return row[b.size()];
+}
+
+static std::vector<uint32_t> random_sequence(std::mt19937 & rng, int max_len, uint32_t alphabet, uint32_t base) {
+    std::vector<uint32_t> s(std::uniform_int_distribution<int>(0, max_len)(rng));
+    for (auto & c : s) {
+        c = base + std::uniform_int_distribution<uint32_t>(0, alphabet - 1)(rng);
+    }
+    return s;
+}
+
+// mutated copy, so most pairs are close like real transcripts
+static std::vector<uint32_t> mutate(std::mt19937 & rng, std::vector<uint32_t> s, uint32_t alphabet, uint32_t base) {
+    const int edits = std::uniform_int_distribution<int>(0, 1 + int(s.size()) / 4)(rng);
+    for (int e = 0; e < edits; e++) {
+        const int op = std::uniform_int_distribution<int>(0, 2)(rng);
+        const uint32_t c = base + std::uniform_int_distribution<uint32_t>(0, alphabet - 1)(rng);
+        const size_t at = s.empty() ? 0 : std::uniform_int_distribution<size_t>(0, s.size() - 1)(rng);
+        if (op == 0 || s.empty()) {
+            s.insert(s.begin() + at, c);
+        } else if (op == 1) {
+            s.erase(s.begin() + at);
+        } else {
+            s[at] = c;
+        }
+    }
+    return s;
+}
+
+static void check_random() {
+    std::mt19937 rng(1234);
+    // ASCII, a small alphabet (many matches), and code points outside ASCII (hashed symbols)
+    const uint32_t alphabets[][2] = { { 26, 'a' }, { 4, 'a' }, { 300, 0x400 }, { 50, 0x1F600 } };
+    for (int i = 0; i < 20000; i++) {
+        const auto & alphabet = alphabets[i % 4];
+        const int max_len = i % 3 == 0 ? 300 : 70; // up to five blocks, and around the 64 boundary
+        const std::vector<uint32_t> a = random_sequence(rng, max_len, alphabet[0], alphabet[1]);
+        const std::vector<uint32_t> b = i % 2 ? mutate(rng, a, alphabet[0], alphabet[1]) : random_sequence(rng, max_len, alphabet[0], alphabet[1]);
+        const int want = reference_distance(a, b);
+        const int got = edit_distance(a, b);
+        CHECK(got == want, "case %d: |a| = %zu, |b| = %zu, distance %d, expected %d", i, a.size(), b.size(), got, want);
+        CHECK(edit_distance(b, a) == want, "case %d: not symmetric", i);
+    }
+}
+
+static std::string to_utf8(const std::vector<uint32_t> & s) {
+    std::string out;
+    for (uint32_t c : s) {
+        if (c < 0x80) {
+            out += char(c);
+        } else if (c < 0x800) {
+            out += char(0xC0 | (c >> 6));
+            out += char(0x80 | (c & 0x3F));
+        } else if (c < 0x10000) {
+            out += char(0xE0 | (c >> 12));
+            out += char(0x80 | ((c >> 6) & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        } else {
+            out += char(0xF0 | (c >> 18));
+            out += char(0x80 | ((c >> 12) & 0x3F));
+            out += char(0x80 | ((c >> 6) & 0x3F));
+            out += char(0x80 | (c & 0x3F));
+        }
+    }
+    return out;
+}
+
+static float reference_similarity(const std::vector<uint32_t> & a, const std::vector<uint32_t> & b) {
+    const size_t len = std::max(a.size(), b.size());
+    return len == 0 ? 1.0f : 1.0f - float(reference_distance(a, b)) / len;
+}
+
+static void check_similarity() {
+    std::mt19937 rng(99);
+    const float thresholds[] = { 0.0f, 0.5f, 0.8f, 0.9f };
+    for (int i = 0; i < 5000; i++) {
+        const uint32_t base = i % 2 ? 0x3B1 : 0x4E00; // greek, CJK: two and three byte sequences
+        const std::vector<uint32_t> a = random_sequence(rng, 150, 20, base);
+        const std::vector<uint32_t> b = mutate(rng, a, 20, base);
+        const float want = reference_similarity(a, b);
+        const float min_similarity = thresholds[i % 4];
+        const float got = similarity(to_utf8(a), to_utf8(b), min_similarity);
+        if (want >= min_similarity) {
+            CHECK(std::fabs(got - want) < 1e-6f, "case %d: similarity %f, expected %f", i, got, want);
+        } else {
+            CHECK(got < min_similarity, "case %d: similarity %f should stay below %f (exact %f)", i, got, min_similarity, want);
+        }
+    }
+}
+
+static void check_invalid_utf8() {
+    // every byte that is not part of a valid sequence is one symbol of its own
+    CHECK(similarity("a\xff", "a\xfe") == 0.5f, "distinct invalid bytes compare unequal");
+    CHECK(similarity("a\xff", "a\xff") == 1.0f, "equal invalid bytes compare equal");
+    CHECK(similarity("\xc3", "\xc3\xa8") == 0.0f, "a truncated sequence is not the full character");
+    CHECK(similarity("x\xa8y", "xy") == 1.0f - 1.0f / 3.0f, "a stray continuation byte counts once");
+    CHECK(similarity("caf\xc3\xa8", "cafe") == 0.75f, "a two byte character is one code point");
+    CHECK(similarity("\xe2\x82", "\xe2\x82\xac") == 0.0f, "a cut three byte sequence is two symbols, not the euro sign");
+
+    // long enough for several blocks, with invalid bytes mixed in
+    std::string a, b;
+    for (int i = 0; i < 100; i++) {
+        a += i % 7 ? "\xc3\xa0" : "\xf8";
+        b += i % 7 ? "\xc3\xa0" : "\xf9";
+    }
+    CHECK(std::fabs(similarity(a, b) - (1.0f - 15.0f / 100.0f)) < 1e-6f, "invalid bytes across blocks: %f", similarity(a, b));
+}
+
+int main() {
+    check_random();
+    check_similarity();
+    check_invalid_utf8();
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("edit distance: all checks passed\n");
+    return 0;
+}
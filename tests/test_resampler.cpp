@@ -0,0 +1,62 @@
+// Checks the polyphase resampler in common.cpp: unity gain in the passband and at least
+// 85 dB of attenuation from the output Nyquist frequency on, for the usual input rates.
+
+#include "common.h"
+
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(cond, ...) do { if (!(cond)) { fprintf(stderr, "FAIL %s:%d: ", __FILE__, __LINE__); fprintf(stderr, __VA_ARGS__); fprintf(stderr, "\n"); failures++; } } while (0)
+
+// gain in dB of a full-scale sine at freq through the resampler, edges left out
+static double gain_db(int rate, double freq) {
+    polyphase_resampler resampler(rate, COMMON_SAMPLE_RATE);
+    std::vector<float> in(size_t(rate) * 2);
+    for (size_t i = 0; i < in.size(); i++) {
+        in[i] = float(std::sin(2.0 * M_PI * freq * double(i) / rate));
+    }
+    std::vector<float> out;
+    resampler.process(in.data(), in.size(), out);
+    resampler.flush(out);
+
+    double sum = 0.0;
+    size_t n = 0;
+    for (size_t i = out.size() / 4; i < out.size() * 3 / 4; i++) {
+        sum += double(out[i]) * out[i];
+        n++;
+    }
+    return 10.0 * std::log10(sum / double(n) / 0.5 + 1e-30);
+}
+
+int main() {
+    for (int rate : { 8000, 22050, 32000, 44100, 48000 }) {
+        polyphase_resampler resampler(rate, COMMON_SAMPLE_RATE);
+        std::vector<float> in(size_t(rate), 0.0f);
+        std::vector<float> out;
+        resampler.process(in.data(), in.size(), out);
+        resampler.flush(out);
+        CHECK(out.size() == COMMON_SAMPLE_RATE, "%d Hz: one second gave %zu samples", rate, out.size());
+
+        for (double freq : { 300.0, 1000.0, 3000.0, 6000.0 }) {
+            if (freq < rate / 2) {
+                const double g = gain_db(rate, freq);
+                CHECK(std::fabs(g) < 0.05, "%d Hz: %.0f Hz passes at %.2f dB", rate, freq, g);
+            }
+        }
+        for (double freq : { 8100.0, 8500.0, 9000.0, 12000.0, 15000.0, 20000.0 }) {
+            if (freq < rate / 2) {
+                const double g = gain_db(rate, freq);
+                CHECK(g < -85.0, "%d Hz: %.0f Hz only %.1f dB down", rate, freq, g);
+            }
+        }
+    }
+    if (failures > 0) {
+        fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    printf("resampler: all checks passed\n");
+    return 0;
+}
@@ -0,0 +1,169 @@
+#define _USE_MATH_DEFINES // for M_PI
+
+#include "threadtuner.h"
+#include "common.h"
+
+#include <QElapsedTimer>
+#include <QFileInfo>
+#include <QSettings>
+#include <QDebug>
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <thread>
+
+// seconds of audio encoded per job and repetition, short enough to calibrate large models
+static const int kWorkloadSeconds = 10;
+static const int kWorkloadRepetitions = 2;
+
+QString ThreadTuner::settingsGroup(const whisper_params &params) {
+    const QString model = QFileInfo(Transcriber::modelPath(params)).fileName();
+    return QString("tuning/%1/%2/%3").arg(HardwareInfo::hostId(), model, params.use_gpu ? "gpu" : "cpu");
+}
+
+TuningResult ThreadTuner::defaults(const CpuTopology &topology) {
+    TuningResult result;
+    result.jobs = 1;
+    result.threads = qBound(1, topology.physicalCores, 4);
+    // whisper scales poorly past a handful of threads, spread the rest over jobs
+    if (topology.physicalCores >= 8) {
+        result.jobs = topology.physicalCores / result.threads;
+    }
+    return result;
+}
+
+TuningResult ThreadTuner::load(const whisper_params &params) {
+    QSettings settings("ImproveYourMix", "VideoTranscriber");
+    settings.beginGroup(settingsGroup(params));
+    if (!settings.contains("jobs") || !settings.contains("threads")) {
+        return defaults(HardwareInfo::cpuTopology());
+    }
+
+    TuningResult result;
+    result.jobs = qMax(1, settings.value("jobs").toInt());
+    result.threads = qMax(1, settings.value("threads").toInt());
+    result.jobsPerMinute = settings.value("jobsPerMinute").toDouble();
+    result.calibrated = true;
+    return result;
+}
+
+QVector<TuningResult> ThreadTuner::candidates(const CpuTopology &topology) {
+    QVector<TuningResult> result;
+    const int threadCounts[] = { 1, 2, 3, 4, 6, 8, 12, 16, 24, 32 };
+
+    auto add = [&](int jobs, int threads) {
+        if (jobs < 1 || jobs * threads > topology.logicalCpus) {
+            return;
+        }
+        for (const auto &c : result) {
+            if (c.jobs == jobs && c.threads == threads) {
+                return;
+            }
+        }
+        TuningResult c;
+        c.jobs = jobs;
+        c.threads = threads;
+        result.append(c);
+    };
+
+    for (int threads : threadCounts) {
+        if (threads > topology.logicalCpus) {
+            break;
+        }
+        // one job per group of physical cores, and the same using the SMT siblings as well
+        add(qMax(1, topology.physicalCores / threads), threads);
+        add(topology.logicalCpus / threads, threads);
+    }
+
+    std::sort(result.begin(), result.end(), [](const TuningResult &a, const TuningResult &b) {
+        return a.jobs != b.jobs ? a.jobs < b.jobs : a.threads < b.threads;
+    });
+    return result;
+}
+
+double ThreadTuner::measure(struct whisper_context *ctx, const std::vector<float> &pcmf32, int jobs, int threads) {
+    std::vector<whisper_state *> states;
+    for (int j = 0; j < jobs; ++j) {
+        whisper_state *state = whisper_init_state(ctx);
+        if (!state) {
+            break;
+        }
+        states.push_back(state);
+    }
+
+    double jobsPerMinute = 0.0;
+    if ((int) states.size() == jobs) {
+        QElapsedTimer timer;
+        timer.start();
+
+        std::vector<std::thread> workers;
+        for (auto *state : states) {
+            workers.emplace_back([ctx, state, &pcmf32, threads]() {
+                for (int r = 0; r < kWorkloadRepetitions; ++r) {
+                    whisper_pcm_to_mel_with_state(ctx, state, pcmf32.data(), pcmf32.size(), threads);
+                    whisper_encode_with_state(ctx, state, 0, threads);
+                }
+            });
+        }
+        for (auto &worker : workers) {
+            worker.join();
+        }
+
+        const double minutes = timer.nsecsElapsed() / 60e9;
+        jobsPerMinute = minutes > 0.0 ? (jobs * kWorkloadRepetitions) / minutes : 0.0;
+    }
+
+    for (auto *state : states) {
+        whisper_free_state(state);
+    }
+    return jobsPerMinute;
+}
+
+TuningResult ThreadTuner::calibrate(const whisper_params &params) {
+    const CpuTopology topology = HardwareInfo::cpuTopology();
+    qInfo("calibrate: %d logical cpus, %d physical cores, %d package(s)", topology.logicalCpus, topology.physicalCores, topology.packages);
+
+    whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = params.use_gpu;
+    const std::string modelPath = Transcriber::modelPath(params).toStdString();
+    struct whisper_context *ctx = whisper_init_from_file_with_params(modelPath.c_str(), cparams);
+    if (!ctx) {
+        qWarning() << "calibrate: failed to load model" << QString::fromStdString(modelPath);
+        return defaults(topology);
+    }
+
+    // deterministic speech-like workload: a few harmonics plus noise
+    std::vector<float> pcmf32(kWorkloadSeconds * COMMON_SAMPLE_RATE);
+    std::mt19937 rng(42);
+    std::normal_distribution<float> noise(0.0f, 0.02f);
+    for (size_t i = 0; i < pcmf32.size(); ++i) {
+        const float t = float(i) / COMMON_SAMPLE_RATE;
+        pcmf32[i] = 0.2f * sinf(2.0f * float(M_PI) * 180.0f * t) + 0.1f * sinf(2.0f * float(M_PI) * 360.0f * t) + noise(rng);
+    }
+
+    // warm up allocators and compute graphs before timing anything
+    measure(ctx, pcmf32, 1, qMin(4, topology.physicalCores));
+
+    TuningResult best = defaults(topology);
+    for (auto candidate : candidates(topology)) {
+        candidate.jobsPerMinute = measure(ctx, pcmf32, candidate.jobs, candidate.threads);
+        qInfo("calibrate: %2d jobs x %2d threads -> %.2f jobs/min", candidate.jobs, candidate.threads, candidate.jobsPerMinute);
+        // prefer fewer concurrent jobs unless more of them are clearly faster (memory, latency)
+        if (candidate.jobsPerMinute > best.jobsPerMinute * 1.05) {
+            best = candidate;
+        }
+    }
+    whisper_free(ctx);
+
+    best.calibrated = best.jobsPerMinute > 0.0;
+    if (best.calibrated) {
+        QSettings settings("ImproveYourMix", "VideoTranscriber");
+        settings.beginGroup(settingsGroup(params));
+        settings.setValue("jobs", best.jobs);
+        settings.setValue("threads", best.threads);
+        settings.setValue("jobsPerMinute", best.jobsPerMinute);
+        qInfo("calibrate: using %d jobs x %d threads", best.jobs, best.threads);
+    }
+    return best;
+}
@@ -0,0 +1,37 @@
+#ifndef THREADTUNER_H
+#define THREADTUNER_H
+
+#include <QString>
+#include <QVector>
+#include "hardwareinfo.h"
+#include "transcriber.h"
+
+struct TuningResult {
+    int jobs       = 1;     // concurrent transcriptions
+    int threads    = 4;     // whisper n_threads per transcription
+    double jobsPerMinute = 0.0;
+    bool calibrated = false;
+};
+
+// Finds the jobs x threads split that maximizes throughput on this host.
+// Results are persisted per host and model, the queue manager picks them up.
+class ThreadTuner {
+public:
+    // stored configuration for the model on this host, or a topology based default
+    static TuningResult load(const whisper_params &params);
+
+    // default derived from the cpu topology only: fill physical cores, ignore SMT siblings
+    static TuningResult defaults(const CpuTopology &topology);
+
+    // configurations worth measuring on this topology
+    static QVector<TuningResult> candidates(const CpuTopology &topology);
+
+    // runs the fixed workload under every candidate, stores and returns the best one
+    static TuningResult calibrate(const whisper_params &params);
+
+private:
+    static QString settingsGroup(const whisper_params &params);
+    static double measure(struct whisper_context *ctx, const std::vector<float> &pcmf32, int jobs, int threads);
+};
+
+#endif // THREADTUNER_H
@@ -1,13 +1,23 @@
 #include "transcriber.h"
 #include "dr_wav.h"
 #include "common.h"
+#include "mediaprobe.h"
+#include "melcache.h"
+#include "dualdecoder.h"
+#include "languagedetector.h"
+#include "modelvariants.h"
+#include "modelverifier.h"
 
 #include <QDir>
 #include <QFileInfo>
+#include <QPair>
 #include <QProcess>
+#include <QSaveFile>
 #include <QCoreApplication>
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
 #include <ctime>
 
 Transcriber::Transcriber(std::atomic<bool>* abortFlag, QObject *parent)
@@ -18,22 +28,138 @@ void Transcriber::setFileAndOutput(const QString &file, const QString &outputFol
     this->outputFolder = outputFolder;
 }
 
+void Transcriber::setParams(const whisper_params &params) {
+    this->params = params;
+}
+
+void Transcriber::setPlacement(const WorkerPlacement &placement) {
+    this->placement = placement;
+}
+
+QString Transcriber::modelPath(const whisper_params &params) {
+    const QString path = QCoreApplication::applicationDirPath() + "/" + QString::fromStdString(params.model);
+    if (params.model_variant.empty()) {
+        return path;
+    }
+    // the original until the variant has been made
+    const QString variant = ModelVariants::variantPath(path, QString::fromStdString(params.model_variant));
+    return QFileInfo::exists(variant) ? variant : path;
+}
+
+void Transcriber::preloadModels(const whisper_params &params) {
+    ModelManager &manager = ModelManager::instance();
+    manager.setBudgetBytes(qint64(params.model_cache_mb) * 1024 * 1024);
+    if (!params.preview_model.empty()) {
+        whisper_params previewParams = params;
+        previewParams.model = params.preview_model;
+        previewParams.model_variant.clear();
+        manager.preload(modelPath(previewParams), params.use_gpu, params.n_threads);
+    }
+    if (params.detect_language || params.language == "auto") {
+        whisper_params detectParams = params;
+        detectParams.model = LanguageDetector::detectionModel(params);
+        manager.preload(modelPath(detectParams), params.use_gpu, params.n_threads);
+    }
+    manager.preload(modelPath(params), params.use_gpu, params.n_threads);
+}
+
+bool Transcriber::setDecoding(whisper_params &params, const QString &decoding) {
+    if (decoding != "greedy" && decoding != "beam" && decoding != "adaptive") {
+        return false;
+    }
+    params.beam_search = decoding == "beam";
+    params.adaptive_beam = decoding == "adaptive";
+    return true;
+}
+
+int Transcriber::audioCtxFor(struct whisper_context *ctx, size_t n_samples, const whisper_params &params) {
+    if (params.audio_ctx > 0 || !params.auto_audio_ctx) {
+        return params.audio_ctx;
+    }
+
+    // large-v3 family (128 mel bins) is known to hallucinate with a truncated encoder context
+    if (whisper_model_n_mels(ctx) != 80) {
+        return 0;
+    }
+
+    // very short contexts cost accuracy, more so for the bigger models: keep a per-model floor
+    const std::string type = whisper_model_type_readable(ctx);
+    int minCtx = 128;
+    if (type == "small") {
+        minCtx = 192;
+    } else if (type == "medium" || type == "large") {
+        minCtx = 256;
+    }
+
+    const int n_audio_ctx = whisper_model_n_audio_ctx(ctx); // 1500 frames for 30 s
+    const int64_t ms = int64_t(n_samples) * 1000 / WHISPER_SAMPLE_RATE + params.audio_ctx_margin_ms;
+    int frames = int((ms * n_audio_ctx + 29999) / 30000);
+
+    // round up to a multiple of 64 so only a few distinct graph sizes are ever built
+    frames = std::max(minCtx, (frames + 63) / 64 * 64);
+    return frames >= n_audio_ctx ? 0 : frames;
+}
+
+void Transcriber::setPackedClips(const QVector<packed_clip> &clips) {
+    this->packedClips = clips;
+}
+
+void Transcriber::setPreview(bool preview) {
+    this->preview = preview;
+}
+
+QString Transcriber::outputPath(const QString &inputFile, const QString &outputFolder) const {
+    return outputFolder + "/" + QFileInfo(inputFile).completeBaseName() + (preview ? ".preview.json" : ".json");
+}
+
+// a preview never overwrites a final transcript, the final one retires the preview
+bool Transcriber::writeOutput(const ModelLease &model, const QString &outputFile, const std::vector<transcript_segment> &segments,
+                              const QString &title, const QString &link, int clip, const std::vector<transcript_segment> *translation) {
+    const QString previewFile = preview ? outputFile : outputFile.chopped(5) + ".preview.json";
+    const QString finalFile = preview ? outputFile.chopped(13) + ".json" : outputFile;
+    if (preview && QFileInfo(finalFile).lastModified() >= startedAt) {
+        qInfo() << "Final output already written, dropping preview" << outputFile;
+        return false;
+    }
+
+    qInfo() << "Output JSON: " << outputFile;
+    if (!output_json(model.context(), model.whisperState(), outputFile.toLocal8Bit().constData(), params, segments, params.output_jsn_full, title, link, translation)) {
+        qWarning() << "Failed to write" << outputFile;
+        return false;
+    }
+    if (!preview) {
+        QFile::remove(previewFile);
+    }
+    emit outputWritten(clip, outputFile);
+    return true;
+}
+
 void Transcriber::startTranscription() {
     if (abortFlag->load()) return;
+    startedAt = QDateTime::currentDateTime();
+
+    // pin before anything is allocated so PCM buffers and whisper state land on the job's node
+    if (placement.isValid()) {
+        placementApplied = WorkerPlacementPlanner::apply(placement);
+        qInfo() << "placement: node" << placement.node << "cpus" << placement.cpuList() << (placementApplied ? "pinned" : "not pinned");
+    }
+
+    if (!packedClips.isEmpty()) {
+        transcribePacked();
+        emit transcriptionFinished();
+        return;
+    }
 
-    QFileInfo fileInfo(file);
-    QString wavFile = outputFolder + "/" + fileInfo.completeBaseName() + ".wav";
-    QString outputFile = outputFolder + "/" + fileInfo.completeBaseName() + ".json";
+    QString outputFile = outputPath(file, outputFolder);
 
-    qInfo() << "Transcribing file: " << wavFile;
+    qInfo() << "Transcribing file: " << file;
     qInfo() << "Output file: " << outputFile;
 
-    if (fileInfo.suffix() == "mp4") {
-        qInfo() << "Extracting audio";
-        emit statusUpdated("Extracting audio");
-        extractAudio(file, wavFile);
-    } else {
-        wavFile = file; // Use the WAV file directly
+    QString wavFile = prepareAudio(file, outputFolder);
+    if (wavFile.isEmpty()) {
+        emit statusUpdated("Failed to extract audio");
+        emit transcriptionFinished();
+        return;
     }
 
     emit statusUpdated("Transcribing");
@@ -45,38 +171,58 @@ void Transcriber::abortTranscription() {
     abortFlag->store(true);
 }
 
-void Transcriber::extractAudio(const QString &inputFile, const QString &outputFile) {
+bool Transcriber::extractAudio(const QString &inputFile, const QString &outputFile) {
     QProcess process;
     QString ffmpegPath = QCoreApplication::applicationDirPath() + "/ffmpeg";
     qInfo() << "ffmpeg path" << ffmpegPath;
-    process.start(ffmpegPath, QStringList() << "-y" << "-i" << inputFile << "-ar" << "16000" << "-ac" << "1" << outputFile);
-    process.waitForFinished();
+    process.start(ffmpegPath, QStringList() << "-y" << "-i" << inputFile << "-vn" << "-ar" << "16000" << "-ac" << "1" << outputFile);
+    process.waitForFinished(-1);
     qInfo() << process.readAllStandardError();
     qInfo() << process.readAllStandardOutput();
+    return process.exitStatus() == QProcess::NormalExit && process.exitCode() == 0;
 }
 
-void Transcriber::transcribeFile(const QString &wavFile, const QString &outputFile) {
-    whisper_context_params cparams = whisper_context_default_params();
-    cparams.use_gpu = params.use_gpu;
-    std::string basePath = QCoreApplication::applicationDirPath().toStdString();
-    std::string modelPath = basePath + "/" + params.model;
-    qInfo() << "model path" << QString::fromStdString(modelPath);
-    struct whisper_context *ctx = whisper_init_from_file_with_params(modelPath.c_str(), cparams);
-
-    if (!ctx) {
-        emit statusUpdated("Failed to initialize Whisper context");
-        return;
+// path read_wav can load for the input, extracting the audio first if needed; empty on failure
+QString Transcriber::prepareAudio(const QString &inputFile, const QString &outputFolder) {
+    // decide by content, not by suffix: a .mov or .mkv is as good as an .mp4
+    const MediaProbe::Container container = MediaProbe::container(inputFile);
+    qInfo() << "Container:" << MediaProbe::containerName(container);
+
+    if (container == MediaProbe::Wav) {
+        return inputFile; // Use the WAV file directly, read_wav converts rate and format
     }
 
-    std::vector<float> pcmf32;
-    std::vector<std::vector<float>> pcmf32s;
-    if (!read_wav(wavFile.toStdString(), pcmf32, pcmf32s, false)) {
-        emit statusUpdated("Failed to read WAV file");
-        whisper_free(ctx);
-        return;
+#if defined(WHISPER_FFMPEG)
+    return inputFile; // read_wav decodes it in-process through libav
+#else
+    const QString wavFile = outputFolder + "/" + QFileInfo(inputFile).completeBaseName() + ".wav";
+    qInfo() << "Extracting audio";
+    emit statusUpdated("Extracting audio");
+    return extractAudio(inputFile, wavFile) ? wavFile : QString();
+#endif
+}
+
+ModelLease Transcriber::initContext() {
+    if (!params.model_variant.empty()) {
+        whisper_params base = params;
+        base.model_variant.clear();
+        const QString variant = QString::fromStdString(params.model_variant);
+        emit statusUpdated("Preparing " + variant + " model");
+        if (ModelVariants::ensure(Transcriber::modelPath(base), variant).isEmpty()) {
+            qWarning() << "model: no" << variant << "variant, using the original";
+        }
     }
+    const QString modelPath = Transcriber::modelPath(params);
+    qInfo() << "model path" << modelPath;
+    ModelManager::instance().setBudgetBytes(qint64(params.model_cache_mb) * 1024 * 1024);
+    ModelLease model = ModelManager::instance().acquire(modelPath, params.use_gpu);
+    modelResident = model.wasResident();
+    modelLoadMs = model.loadMs();
+    return model;
+}
 
-    whisper_full_params wparams = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
+whisper_full_params Transcriber::fullParams(struct whisper_context *ctx, size_t n_samples, whisper_print_user_data &user_data) {
+    whisper_full_params wparams = whisper_full_default_params(params.beam_search ? WHISPER_SAMPLING_BEAM_SEARCH : WHISPER_SAMPLING_GREEDY);
     wparams.print_realtime   = false;
     wparams.print_progress   = params.print_progress;
     wparams.print_timestamps = !params.no_timestamps;
@@ -91,7 +237,17 @@ void Transcriber::transcribeFile(const QString &wavFile, const QString &outputFi
     wparams.token_timestamps = params.output_wts || params.output_jsn_full || params.max_len > 0;
     wparams.thold_pt         = params.word_thold;
     wparams.max_len          = params.output_wts && params.max_len == 0 ? 60 : params.max_len;
-    wparams.audio_ctx        = params.audio_ctx;
+
+    // only the audio actually decoded counts, offset/duration may cut it down
+    size_t n_decoded = n_samples;
+    const size_t n_offset = size_t(params.offset_t_ms) * WHISPER_SAMPLE_RATE / 1000;
+    n_decoded = n_decoded > n_offset ? n_decoded - n_offset : 0;
+    if (params.duration_ms > 0) {
+        n_decoded = std::min(n_decoded, size_t(params.duration_ms) * WHISPER_SAMPLE_RATE / 1000);
+    }
+    audioCtxUsed             = audioCtxFor(ctx, n_decoded, params);
+    wparams.audio_ctx        = audioCtxUsed;
+    qInfo("audio_ctx: %d (%zu samples)", audioCtxUsed, n_decoded);
 
     wparams.tdrz_enable      = params.tinydiarize;
 
@@ -105,8 +261,6 @@ void Transcriber::transcribeFile(const QString &wavFile, const QString &outputFi
 
     wparams.no_timestamps    = params.no_timestamps;
 
-    whisper_print_user_data user_data = { &params, &pcmf32s, abortFlag, 0, this };
-
     if (!wparams.print_realtime) {
         wparams.new_segment_callback           = [](struct whisper_context * ctx, struct whisper_state * state, int n_new, void * user_data) {
             auto & transcriber  = *((whisper_print_user_data *) user_data)->transcriber;
@@ -130,29 +284,461 @@ void Transcriber::transcribeFile(const QString &wavFile, const QString &outputFi
             auto & transcriber  = *((whisper_print_user_data *) user_data)->transcriber;
             transcriber.transcriptionFinished(true);
         }
-        return is_aborted.load();
+        // a repetition loop stops the pass early, transcribeFile resumes behind it
+        auto & transcriber  = *((whisper_print_user_data *) user_data)->transcriber;
+        return is_aborted.load() || transcriber.loopDetected;
     };
     wparams.abort_callback_user_data = &user_data;
 
-    qInfo("Starting transcribe");
-    if (whisper_full(ctx, wparams, pcmf32.data(), pcmf32.size()) != 0) {
-        emit statusUpdated("Failed to process audio");
-        whisper_free(ctx);
+    return wparams;
+}
+
+// a loop is text that keeps coming back: every new segment close to one of the
+// last few, loop_max_repeats times in a row
+void Transcriber::checkRepetition(const std::string &text, int64_t t0, int64_t t1) {
+    const size_t kHistory = 4;
+
+    // short answers repeat in real speech, only longer text can start or continue a loop
+    if (QString::fromStdString(text).trimmed().size() < params.loop_min_chars) {
+        loopRepeats = 0;
+        return;
+    }
+
+    bool repeated = false;
+    for (const auto &previous : recentSegments) {
+        if (similarity(previous, text, params.loop_similarity) >= params.loop_similarity) {
+            repeated = true;
+            break;
+        }
+    }
+
+    if (repeated) {
+        if (loopRepeats == 0) {
+            loopStart = t0;
+        }
+        loopRepeats++;
+        loopEnd = t1;
+    } else {
+        loopRepeats = 0;
+    }
+
+    recentSegments.push_back(text);
+    if (recentSegments.size() > kHistory) {
+        recentSegments.erase(recentSegments.begin());
+    }
+
+    if (loopRepeats >= params.loop_max_repeats) {
+        loopDetected = true;
+    }
+}
+
+void Transcriber::routeLanguage(const std::vector<float> &pcmf32) {
+    emit statusUpdated("Detecting language");
+    float probability = 0.0f;
+    const QString language = LanguageDetector::detect(file, pcmf32, params, &probability);
+    if (language.isEmpty()) {
+        // unsure: keep the configured language, "auto" leaves it to the full model
+        qInfo("language: keeping %s (p = %.2f)", params.language.c_str(), probability);
+        return;
+    }
+
+    params.language = language.toStdString();
+    // a preview stays on its small model, routing it would defeat the quick draft
+    const auto model = params.language_models.find(params.language);
+    if (model != params.language_models.end() && !preview) {
+        params.model = model->second;
+    }
+    qInfo("language: %s, model %s", params.language.c_str(), params.model.c_str());
+    emit statusUpdated(QString("Language: %1 (%2%)").arg(language).arg(qRound(probability * 100)));
+}
+
+// mel from the cache, computed and stored on a miss; false leaves it to whisper_full
+bool Transcriber::setMel(struct whisper_context *ctx, struct whisper_state *state, const std::vector<float> &pcmf32) {
+    const int n_mel = whisper_model_n_mels(ctx);
+
+    // the filterbank stored in the model, the one whisper computes its own mel with
+    int filter_mels = 0;
+    int n_fft = 0;
+    std::vector<float> filters;
+    if (!ModelVerifier::melFilters(modelPath(params), filter_mels, n_fft, filters) || filter_mels != n_mel || n_fft != 201) {
+        qWarning() << "mel cache: no usable filterbank in the model, whisper computes the mel";
+        return false;
+    }
+
+    MelCache cache(qint64(params.mel_cache_mb) * 1024 * 1024);
+    const QByteArray key = MelCache::key(pcmf32, filters, n_mel);
+
+    std::vector<float> mel;
+    int n_len = 0;
+    const bool hit = cache.load(key, n_mel, mel, n_len);
+    if (!hit) {
+        log_mel_spectrogram(pcmf32.data(), pcmf32.size(), n_mel, filters.data(), params.n_threads, mel, n_len);
+        cache.store(key, n_mel, mel, n_len);
+    }
+    qInfo() << "mel cache:" << (hit ? "hit" : "miss") << key;
+    return whisper_set_mel_with_state(ctx, state, mel.data(), n_len, n_mel) == 0;
+}
+
+void Transcriber::transcribeFile(const QString &wavFile, const QString &outputFile) {
+    std::vector<float> pcmf32;
+    std::vector<std::vector<float>> pcmf32s;
+    if (!read_wav(wavFile.toStdString(), pcmf32, pcmf32s, false)) {
+        emit statusUpdated("Failed to read WAV file");
+        return;
+    }
+
+    // settle language and model before the big model is even loaded
+    if (params.detect_language || params.language == "auto") {
+        routeLanguage(pcmf32);
+    }
+
+    ModelLease model = initContext();
+    if (!model.isValid()) {
+        emit statusUpdated(model.error());
+        return;
+    }
+    struct whisper_context *ctx = model.context();
+    struct whisper_state *state = model.whisperState();
+
+    if (params.dual_output) {
+        transcribeDual(model, pcmf32, outputFile);
         return;
     }
+
+    whisper_print_user_data user_data = { &params, &pcmf32s, abortFlag, 0, this };
+    whisper_full_params wparams = fullParams(ctx, pcmf32.size(), user_data);
+    model.noteAudioCtx(wparams.audio_ctx);
+
+    // token timestamps need the signal energy, which whisper_full only takes from samples
+    if (params.mel_cache && wparams.token_timestamps) {
+        qInfo("mel cache: not used, token timestamps are on (full JSON or word timestamps)");
+    }
+    const bool melSet = params.mel_cache && !wparams.token_timestamps && setMel(ctx, state, pcmf32);
+    if (melSet) {
+        // the mel carries 30 s of trailing padding, stop at the end of the audio
+        const int remainingMs = int(int64_t(pcmf32.size()) * 1000 / WHISPER_SAMPLE_RATE) - wparams.offset_ms;
+        wparams.duration_ms = wparams.duration_ms > 0 ? std::min(wparams.duration_ms, remainingMs) : remainingMs;
+    }
+
+    const int audioMs = int(int64_t(pcmf32.size()) * 1000 / WHISPER_SAMPLE_RATE);
+    const int endMs = wparams.duration_ms > 0 ? std::min(audioMs, wparams.offset_ms + wparams.duration_ms) : audioMs;
+
+    qInfo("Starting transcribe");
+    std::vector<transcript_segment> segments;
+    loopGuard = params.loop_max_repeats > 0;
+    while (true) {
+        loopDetected = false;
+        loopRepeats = 0;
+        recentSegments.clear();
+
+        const int ret = whisper_full_with_state(ctx, state, wparams, melSet ? nullptr : pcmf32.data(), melSet ? 0 : int(pcmf32.size()));
+        if (!loopDetected) {
+            if (ret != 0) {
+                emit statusUpdated("Failed to process audio");
+                return;
+            }
+            const std::vector<transcript_segment> pass = collectSegments(ctx, state);
+            segments.insert(segments.end(), pass.begin(), pass.end());
+            break;
+        }
+
+        // keep the text up to the first repetition, resume behind the loop with a cleared prompt
+        for (const auto &segment : collectSegments(ctx, state)) {
+            if (segment.t0 < loopStart) {
+                segments.push_back(segment);
+            }
+        }
+        const int resumeMs = std::max(wparams.offset_ms + 1000, int(loopEnd * 10) + 1000);
+        qInfo("Repetition loop [%lld, %lld] cs, resuming at %d ms", (long long) loopStart, (long long) loopEnd, resumeMs);
+        if (resumeMs + 1000 >= endMs) {
+            break;
+        }
+        emit statusUpdated("Skipping repeated output");
+        wparams.offset_ms = resumeMs;
+        wparams.duration_ms = endMs - resumeMs;
+        wparams.no_context = true;
+        wparams.initial_prompt = nullptr;
+        wparams.prompt_tokens = nullptr;
+        wparams.prompt_n_tokens = 0;
+    }
+    loopGuard = false;
+    loopDetected = false;
     qInfo("Transcribe finished");
 
-    const auto fname_jsn = outputFile.toStdString();
-    qInfo() << "Output JSON: " << fname_jsn.c_str();
-    output_json(ctx, fname_jsn.c_str(), params, pcmf32s, params.output_jsn_full);
+    if (params.adaptive_beam && params.beam_size > 1) {
+        emit statusUpdated("Refining");
+        refineSegments(model, wparams, pcmf32, segments);
+    }
 
-    whisper_free(ctx);
+    writeOutput(model, outputFile, segments, videoTitle, videoHrefLink);
 
     emit progressUpdated(100);
     emit statusUpdated("Completed");
     emit totalProgressUpdated(100); // Emitting the total progress
 }
 
+// mean log probability of the text tokens, 0 for a segment without any
+static float meanLogprob(const transcript_segment &segment, whisper_token eot) {
+    double sum = 0.0;
+    int n = 0;
+    for (const auto &token : segment.tokens) {
+        if (token.id < eot) {
+            sum += std::log(std::max(token.p, 1e-6f));
+            n++;
+        }
+    }
+    return n > 0 ? float(sum / n) : 0.0f;
+}
+
+static bool isLowConfidence(const transcript_segment &segment, whisper_token eot, const whisper_params &params) {
+    double sum = 0.0;
+    int n = 0;
+    for (const auto &token : segment.tokens) {
+        if (token.id < eot) {
+            sum += token.p;
+            n++;
+        }
+    }
+    return n > 0 && (sum / n < params.adaptive_p_thold || meanLogprob(segment, eot) < params.logprob_thold);
+}
+
+// re-decodes runs of low-confidence segments with beam search on just their audio,
+// keeping the beam result where it scores better than the greedy one
+void Transcriber::refineSegments(ModelLease &model, const whisper_full_params &wparams, const std::vector<float> &pcmf32,
+                                 std::vector<transcript_segment> &segments) {
+    struct whisper_context *ctx = model.context();
+    const whisper_token eot = whisper_token_eot(ctx);
+    const int64_t marginCs = 20;      // context on both sides of the sub-window
+    const int64_t maxWindowCs = 2800; // stays within one encoder window
+
+    std::vector<transcript_segment> refined;
+    const size_t n = segments.size();
+    for (size_t i = 0; i < n;) {
+        if (abortFlag->load()) {
+            return;
+        }
+        if (!isLowConfidence(segments[i], eot, params)) {
+            refined.push_back(segments[i++]);
+            continue;
+        }
+
+        // neighbouring unsure segments share one sub-window
+        size_t j = i;
+        while (j + 1 < n && isLowConfidence(segments[j + 1], eot, params)
+               && segments[j + 1].t0 - segments[j].t1 < 100 && segments[j + 1].t1 - segments[i].t0 < maxWindowCs) {
+            j++;
+        }
+
+        const int64_t t0 = segments[i].t0;
+        const int64_t t1 = segments[j].t1;
+        const size_t s0 = size_t(std::max<int64_t>(0, t0 - marginCs)) * WHISPER_SAMPLE_RATE / 100;
+        const size_t s1 = std::min(pcmf32.size(), size_t(t1 + marginCs) * WHISPER_SAMPLE_RATE / 100);
+        const int64_t shiftCs = int64_t(s0) * 100 / WHISPER_SAMPLE_RATE;
+
+        whisper_full_params beam = wparams;
+        beam.strategy = WHISPER_SAMPLING_BEAM_SEARCH;
+        beam.offset_ms = 0;
+        beam.duration_ms = 0;
+        beam.no_context = true;
+        beam.audio_ctx = audioCtxFor(ctx, s1 > s0 ? s1 - s0 : 0, params);
+        beam.new_segment_callback = nullptr;
+        beam.progress_callback = nullptr;
+        model.noteAudioCtx(beam.audio_ctx);
+
+        float greedyScore = 0.0f;
+        for (size_t k = i; k <= j; ++k) {
+            greedyScore += meanLogprob(segments[k], eot);
+        }
+        greedyScore /= float(j - i + 1);
+
+        std::vector<transcript_segment> candidate;
+        if (s1 > s0 && whisper_full_with_state(ctx, model.whisperState(), beam, pcmf32.data() + s0, int(s1 - s0)) == 0) {
+            for (auto segment : collectSegments(ctx, model.whisperState())) {
+                segment.t0 += shiftCs;
+                segment.t1 += shiftCs;
+                for (auto &token : segment.tokens) {
+                    if (token.t0 >= 0) token.t0 += shiftCs;
+                    if (token.t1 >= 0) token.t1 += shiftCs;
+                }
+                const int64_t mid = (segment.t0 + segment.t1) / 2;
+                if (mid >= t0 && mid <= t1) {
+                    candidate.push_back(std::move(segment));
+                }
+            }
+        }
+
+        float beamScore = 0.0f;
+        for (const auto &segment : candidate) {
+            beamScore += meanLogprob(segment, eot);
+        }
+        beamScore = candidate.empty() ? -INFINITY : beamScore / float(candidate.size());
+
+        if (beamScore > greedyScore) {
+            refined.insert(refined.end(), candidate.begin(), candidate.end());
+            refinedSegments += int(j - i + 1);
+        } else {
+            refined.insert(refined.end(), segments.begin() + i, segments.begin() + j + 1);
+        }
+        qInfo("refine: [%lld, %lld] greedy %.3f beam %.3f -> %s", (long long) t0, (long long) t1, greedyScore, beamScore,
+              beamScore > greedyScore ? "beam" : "greedy");
+        i = j + 1;
+    }
+    segments.swap(refined);
+}
+
+void Transcriber::transcribeDual(const ModelLease &model, const std::vector<float> &pcmf32, const QString &outputFile) {
+    DualDecoder decoder(model.context(), model.whisperState(), params);
+
+    qInfo("Starting transcribe and translate");
+    emit statusUpdated("Transcribing and translating");
+    if (!decoder.run(pcmf32, abortFlag, [this](int progress) { emit progressUpdated(progress); })) {
+        emit statusUpdated("Failed to process audio");
+        return;
+    }
+    qInfo("Transcribe and translate finished");
+
+    languageId = decoder.languageId();
+    writeOutput(model, outputFile, decoder.transcript(), videoTitle, videoHrefLink, -1, &decoder.translation());
+
+    emit progressUpdated(100);
+    emit statusUpdated("Completed");
+    emit totalProgressUpdated(100);
+}
+
+// silence between packed clips, long enough for whisper to close the segment
+static const int kPackGapMs = 1500;
+
+void Transcriber::transcribePacked() {
+    QVector<packed_clip> clips;
+    clips.append({ file, outputFolder, videoTitle, videoHrefLink });
+    clips += packedClips;
+
+    auto report = [this](int clip, const QString &status) {
+        if (clip == 0) {
+            emit statusUpdated(status);
+        } else {
+            emit clipStatusUpdated(clip - 1, status);
+        }
+    };
+
+    ModelLease model = initContext();
+    if (!model.isValid()) {
+        for (int i = 0; i < clips.size(); ++i) {
+            report(i, model.error());
+        }
+        return;
+    }
+    struct whisper_context *ctx = model.context();
+
+    // concatenate with silence in between, remember where every clip landed (centiseconds)
+    const size_t n_gap = size_t(kPackGapMs) * WHISPER_SAMPLE_RATE / 1000;
+    std::vector<float> pcmf32;
+    std::vector<std::vector<float>> pcmf32s;
+    QVector<QPair<int64_t, int64_t>> spans;
+    for (int i = 0; i < clips.size(); ++i) {
+        const QString wavFile = prepareAudio(clips[i].file, clips[i].outputFolder);
+        std::vector<float> clip;
+        std::vector<std::vector<float>> clip_stereo;
+        if (wavFile.isEmpty() || !read_wav(wavFile.toStdString(), clip, clip_stereo, false)) {
+            report(i, "Failed to read WAV file");
+            spans.append(qMakePair(int64_t(-1), int64_t(-1)));
+            continue;
+        }
+        if (!pcmf32.empty()) {
+            pcmf32.insert(pcmf32.end(), n_gap, 0.0f);
+        }
+        const int64_t t0 = int64_t(pcmf32.size()) * 100 / WHISPER_SAMPLE_RATE;
+        pcmf32.insert(pcmf32.end(), clip.begin(), clip.end());
+        spans.append(qMakePair(t0, int64_t(pcmf32.size()) * 100 / WHISPER_SAMPLE_RATE));
+        report(i, "Transcribing (packed)");
+    }
+
+    whisper_print_user_data user_data = { &params, &pcmf32s, abortFlag, 0, this };
+    whisper_full_params wparams = fullParams(ctx, pcmf32.size(), user_data);
+    wparams.no_context = true; // the clips are unrelated
+    model.noteAudioCtx(wparams.audio_ctx);
+
+    qInfo("Starting packed transcribe of %d clips, %zu samples", int(clips.size()), pcmf32.size());
+    if (pcmf32.empty() || whisper_full_with_state(ctx, model.whisperState(), wparams, pcmf32.data(), pcmf32.size()) != 0) {
+        for (int i = 0; i < clips.size(); ++i) {
+            if (spans[i].first >= 0) {
+                report(i, "Failed to process audio");
+            }
+        }
+        return;
+    }
+
+    // a segment belongs to the clip its midpoint falls in, half the gap counts on both sides
+    const std::vector<transcript_segment> segments = collectSegments(ctx, model.whisperState());
+    const int64_t halfGap = kPackGapMs / 20;
+    for (int i = 0; i < clips.size(); ++i) {
+        const int64_t begin = spans[i].first;
+        const int64_t end = spans[i].second;
+        if (begin < 0) {
+            continue;
+        }
+
+        auto shift = [begin, end](int64_t t) {
+            return t < 0 ? t : std::min(std::max(t - begin, int64_t(0)), end - begin);
+        };
+
+        std::vector<transcript_segment> own;
+        for (const auto &segment : segments) {
+            const int64_t mid = (segment.t0 + segment.t1) / 2;
+            if (mid < begin - halfGap || mid >= end + halfGap) {
+                continue;
+            }
+            transcript_segment s = segment;
+            s.t0 = shift(s.t0);
+            s.t1 = shift(s.t1);
+            for (auto &token : s.tokens) {
+                token.t0 = shift(token.t0);
+                token.t1 = shift(token.t1);
+            }
+            own.push_back(std::move(s));
+        }
+
+        writeOutput(model, outputPath(clips[i].file, clips[i].outputFolder), own, clips[i].title, clips[i].link, i - 1);
+
+        report(i, "Completed");
+        if (i == 0) {
+            emit progressUpdated(100);
+        } else {
+            emit clipFinished(i - 1);
+        }
+    }
+
+    emit totalProgressUpdated(100);
+}
+
+std::vector<transcript_segment> Transcriber::collectSegments(struct whisper_context *ctx, struct whisper_state *state) {
+    std::vector<transcript_segment> segments;
+    const int n_segments = whisper_full_n_segments_from_state(state);
+    segments.reserve(n_segments);
+    for (int i = 0; i < n_segments; ++i) {
+        transcript_segment segment;
+        segment.t0 = whisper_full_get_segment_t0_from_state(state, i);
+        segment.t1 = whisper_full_get_segment_t1_from_state(state, i);
+        segment.text = whisper_full_get_segment_text_from_state(state, i);
+
+        const int n = whisper_full_n_tokens_from_state(state, i);
+        segment.tokens.reserve(n);
+        for (int j = 0; j < n; ++j) {
+            const auto data = whisper_full_get_token_data_from_state(state, i, j);
+            transcript_token token;
+            token.id = data.id;
+            token.text = whisper_token_to_str(ctx, data.id);
+            token.t0 = data.t0;
+            token.t1 = data.t1;
+            token.p = data.p;
+            token.t_dtw = data.t_dtw;
+            segment.tokens.push_back(std::move(token));
+        }
+        segments.push_back(std::move(segment));
+    }
+    return segments;
+}
+
 void Transcriber::whisper_print_progress_callback(struct whisper_context * /*ctx*/, struct whisper_state * /*state*/, int progress, void * user_data) {
     qInfo("whisper_print_progress_callback");
     int progress_step = ((whisper_print_user_data *) user_data)->params->progress_step;
@@ -166,10 +752,10 @@ void Transcriber::whisper_print_progress_callback(struct whisper_context * /*ctx
     }
 }
 
-void Transcriber::whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * /*state*/, int n_new, void * user_data) {
+void Transcriber::whisper_print_segment_callback(struct whisper_context * /*ctx*/, struct whisper_state * state, int n_new, void * user_data) {
     qInfo("whisper_print_segment_callback");
     const auto & params  = *((whisper_print_user_data *) user_data)->params;
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
 
     std::string speaker = "";
 
@@ -184,15 +770,15 @@ void Transcriber::whisper_print_segment_callback(struct whisper_context * ctx, s
 
     for (int i = s0; i < n_segments; i++) {
         if (!params.no_timestamps || params.diarize) {
-            t0 = whisper_full_get_segment_t0(ctx, i);
-            t1 = whisper_full_get_segment_t1(ctx, i);
+            t0 = whisper_full_get_segment_t0_from_state(state, i);
+            t1 = whisper_full_get_segment_t1_from_state(state, i);
         }
 
         if (!params.no_timestamps) {
             printf("[%s --> %s]  ", to_timestamp(t0).c_str(), to_timestamp(t1).c_str());
         }
 
-        const char * text = whisper_full_get_segment_text(ctx, i);
+        const char * text = whisper_full_get_segment_text_from_state(state, i);
 
         printf("%s%s", speaker.c_str(), text);
 
@@ -202,6 +788,13 @@ void Transcriber::whisper_print_segment_callback(struct whisper_context * ctx, s
 
         fflush(stdout);
     }
+
+    if (loopGuard) {
+        for (int i = s0; i < n_segments; i++) {
+            checkRepetition(whisper_full_get_segment_text_from_state(state, i), whisper_full_get_segment_t0_from_state(state, i),
+                            whisper_full_get_segment_t1_from_state(state, i));
+        }
+    }
 }
 
 char* escape_double_quotes(const char* input) {
@@ -277,11 +870,16 @@ int64_t Transcriber::get_current_timestamp_ms() {
 
 bool Transcriber::output_json(
     struct whisper_context * ctx,
+    struct whisper_state * state,
     const char * fname,
     const whisper_params & params,
-    std::vector<std::vector<float>> pcmf32s,
-    bool full) {
-    std::ofstream fout(fname);
+    const std::vector<transcript_segment> & segments,
+    bool full,
+    const QString &title,
+    const QString &link,
+    const std::vector<transcript_segment> * translation) {
+    // built in memory and committed in one step, readers never see a half written file
+    std::ostringstream fout;
     int indent = 0;
 
     std::ostringstream videoTextStream;
@@ -363,11 +961,6 @@ bool Transcriber::output_json(
         end_obj(end);
     };
 
-    if (!fout.is_open()) {
-        fprintf(stderr, "%s: failed to open '%s' for writing\n", __func__, fname);
-        return false;
-    }
-
     fprintf(stderr, "%s: saving output to '%s'\n", __func__, fname);
     start_obj(nullptr);
     value_s("systeminfo", whisper_print_system_info(), false);
@@ -395,59 +988,82 @@ bool Transcriber::output_json(
     value_s("language", params.language.c_str(), false);
     value_b("translate", params.translate, true);
     end_obj(false);
+    start_obj("metrics");
+    value_i("threads", params.n_threads, false);
+    value_i("audio_ctx", audioCtxUsed, false);
+    value_i("refined_segments", refinedSegments, false);
+    value_b("model_resident", modelResident, false);
+    value_i("model_load_ms", modelLoadMs, false);
+    start_obj("placement");
+    value_b("pinned", placementApplied, false);
+    value_i("node", placement.node, false);
+    value_s("cpus", placement.cpuList().toStdString().c_str(), true);
+    end_obj(true);
+    end_obj(false);
     start_obj("result");
-    value_s("language", whisper_lang_str(whisper_full_lang_id(ctx)), true);
+    value_s("language", whisper_lang_str(languageId >= 0 ? languageId : whisper_full_lang_id_from_state(state)), true);
     end_obj(false);
-    start_arr("transcription");
-
-    const int n_segments = whisper_full_n_segments(ctx);
-    for (int i = 0; i < n_segments; ++i) {
-        const char* text = whisper_full_get_segment_text(ctx, i);
-
-        // Rimuovi le virgolette doppie nella variabile text
-        char* no_quotes_text = remove_double_quotes(text);
+    auto write_segments = [&](const char *name, const std::vector<transcript_segment> & segments, bool last, std::ostringstream *textStream) {
+        start_arr(name);
 
-        videoTextStream << no_quotes_text << " ";
+        const int n_segments = int(segments.size());
+        for (int i = 0; i < n_segments; ++i) {
+            const transcript_segment & segment = segments[i];
+            const char* text = segment.text.c_str();
 
-        const int64_t t0 = whisper_full_get_segment_t0(ctx, i);
-        const int64_t t1 = whisper_full_get_segment_t1(ctx, i);
+            // Rimuovi le virgolette doppie nella variabile text
+            char* no_quotes_text = remove_double_quotes(text);
 
-        start_obj(nullptr);
-        times_o(t0, t1, false);
-        value_s("text", no_quotes_text, !params.diarize && !params.tinydiarize && !full);
-
-        free(no_quotes_text); // Libera la memoria allocata per no_quotes_text
+            if (textStream) {
+                *textStream << no_quotes_text << " ";
+            }
 
-        if (full) {
-            start_arr("tokens");
-            const int n = whisper_full_n_tokens(ctx, i);
-            for (int j = 0; j < n; ++j) {
-                auto token = whisper_full_get_token_data(ctx, i, j);
-                start_obj(nullptr);
-                char* token_text = remove_double_quotes(whisper_token_to_str(ctx, token.id));
-                value_s("text", token_text, false);
-                free(token_text);
-                if (token.t0 > -1 && token.t1 > -1) {
-                    times_o(token.t0, token.t1, false);
+            const int64_t t0 = segment.t0;
+            const int64_t t1 = segment.t1;
+
+            start_obj(nullptr);
+            times_o(t0, t1, false);
+            value_s("text", no_quotes_text, !params.diarize && !params.tinydiarize && !full);
+
+            free(no_quotes_text); // Libera la memoria allocata per no_quotes_text
+
+            if (full) {
+                start_arr("tokens");
+                const int n = int(segment.tokens.size());
+                for (int j = 0; j < n; ++j) {
+                    const auto & token = segment.tokens[j];
+                    start_obj(nullptr);
+                    char* token_text = remove_double_quotes(token.text.c_str());
+                    value_s("text", token_text, false);
+                    free(token_text);
+                    if (token.t0 > -1 && token.t1 > -1) {
+                        times_o(token.t0, token.t1, false);
+                    }
+                    value_i("id", token.id, false);
+                    value_f("p", token.p, false);
+                    value_f("t_dtw", token.t_dtw, true);
+                    end_obj(j == (n - 1));
                 }
-                value_i("id", token.id, false);
-                value_f("p", token.p, false);
-                value_f("t_dtw", token.t_dtw, true);
-                end_obj(j == (n - 1));
+                end_arr(!params.diarize && !params.tinydiarize);
             }
-            end_arr(!params.diarize && !params.tinydiarize);
+
+            end_obj(i == (n_segments - 1));
         }
 
-        end_obj(i == (n_segments - 1));
-    }
+        end_arr(last);
+    };
 
-    end_arr(false);
+    write_segments("transcription", segments, false, &videoTextStream);
+    if (translation) {
+        // English translation of the same audio, decoded from the same encoder passes
+        write_segments("translation", *translation, false, nullptr);
+    }
 
     // Aggiungi videoTitle e videoHrefLink
     start_value("videoTitle");
-    fout << "\"" << videoTitle.toStdString() << "\",\n";
+    fout << "\"" << title.toStdString() << "\",\n";
     start_value("videoHrefLink");
-    fout << "\"" << videoHrefLink.toStdString() << "\",\n";
+    fout << "\"" << link.toStdString() << "\",\n";
 
     start_value("videoText");
     fout << "\"" << remove_double_quotes(videoTextStream.str().c_str()) << "\",\n";
@@ -457,7 +1073,15 @@ bool Transcriber::output_json(
     fout << "\"" << get_current_timestamp_ms() << "\"\n";
 
     end_obj(true);
-    return true;
+
+    QSaveFile file(QString::fromLocal8Bit(fname));
+    if (!file.open(QIODevice::WriteOnly)) {
+        fprintf(stderr, "%s: failed to open '%s' for writing: %s\n", __func__, fname, file.errorString().toLocal8Bit().constData());
+        return false;
+    }
+    const std::string json = fout.str();
+    file.write(json.data(), qint64(json.size()));
+    return file.commit();
 }
 
 
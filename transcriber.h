@@ -2,13 +2,23 @@
 #define TRANSCRIBER_H
 
 #include <QObject>
+#include <QDateTime>
 #include <QString>
+#include <QVector>
 #include <vector>
 #include <atomic>
 #include <fstream>
+#include <map>
 #include <sstream>
 #include <thread>
 #include "whisper.h"
+#include "workerplacement.h"
+#include "modelmanager.h"
+
+// model shipped next to the executable, set by the build
+#ifndef VIDEOTRANSCRIBER_MODEL
+#define VIDEOTRANSCRIBER_MODEL "ggml-medium.bin"
+#endif
 
 // command-line parameters
 struct whisper_params {
@@ -22,7 +32,13 @@ struct whisper_params {
     int32_t max_len       = 0;
     int32_t best_of       = whisper_full_default_params(WHISPER_SAMPLING_GREEDY).greedy.best_of;
     int32_t beam_size     = whisper_full_default_params(WHISPER_SAMPLING_BEAM_SEARCH).beam_search.beam_size;
-    int32_t audio_ctx     = 0;
+    int32_t audio_ctx     = 0;     // encoder frames, 0 = full 30 s window (or automatic, see below)
+    int32_t audio_ctx_margin_ms = 1000; // headroom added to short inputs when sizing audio_ctx
+    int32_t mel_cache_mb  = 2048;  // size cap of the mel cache directory
+    int32_t model_cache_mb = 3072; // models kept loaded across jobs, see ModelManager
+    int32_t detect_ms     = 30000; // audio looked at by the language pre-pass
+    int32_t loop_max_repeats = 3;  // repeated segments in a row before skipping ahead, 0 = off
+    int32_t loop_min_chars = 12;   // shorter segments ("Sì.", "Grazie.") are real speech, never a repeat
 
     float word_thold      =  0.01f;
     float entropy_thold   =  2.40f;
@@ -30,6 +46,9 @@ struct whisper_params {
     float grammar_penalty = 100.0f;
     float temperature     = 0.0f;
     float temperature_inc = 0.2f;
+    float loop_similarity = 0.9f;  // segments at least this similar count as repeated
+    float detect_min_p    = 0.5f;  // language pre-pass result is used above this probability
+    float adaptive_p_thold = 0.6f; // mean token probability below which a segment is re-decoded
 
     bool debug_mode      = false;
     bool translate       = false;
@@ -54,10 +73,18 @@ struct whisper_params {
     bool log_score       = false;
     bool use_gpu         = true;
     bool flash_attn      = false;
+    bool auto_audio_ctx  = true;  // shrink the encoder context to the length of short inputs
+    bool beam_search     = false; // beam search for the whole file instead of greedy decoding
+    bool adaptive_beam   = false; // greedy pass, then beam search only where the greedy result is unsure
+    bool dual_output     = false; // transcription plus English translation, one encoder pass per window
+    bool mel_cache       = false; // reuse log-mel spectrograms across runs, not with token timestamps
 
     std::string language  = "it";
     std::string prompt;
-    std::string model     = "./models/ggml-medium.bin";
+    std::string model     = "./models/" VIDEOTRANSCRIBER_MODEL;
+    std::string model_variant;     // quantized variant of model (q5_0, q8_0, ...), made on first use, empty = as is
+    std::string detect_model;      // small multilingual model for the language pre-pass
+    std::string preview_model;     // tiny or base model for a quick .preview.json draft, empty = off
     std::string grammar;
     std::string grammar_rule;
 
@@ -71,11 +98,39 @@ struct whisper_params {
 
     std::string dtw = "";
 
+    // model used for a detected language, e.g. "en" -> an English-only model
+    std::map<std::string, std::string> language_models;
+
     std::vector<std::string> fname_inp = {};
     std::vector<std::string> fname_out = {};
 
 };
 
+// decoded text with timestamps in centiseconds, as returned by whisper_full_get_segment_t0
+struct transcript_token {
+    whisper_token id = 0;
+    std::string text;
+    int64_t t0 = -1;
+    int64_t t1 = -1;
+    float p = 0.0f;
+    float t_dtw = 0.0f;
+};
+
+struct transcript_segment {
+    int64_t t0 = 0;
+    int64_t t1 = 0;
+    std::string text;
+    std::vector<transcript_token> tokens;
+};
+
+// a short input transcribed in the same whisper_full run as the main file
+struct packed_clip {
+    QString file;
+    QString outputFolder;
+    QString title;
+    QString link;
+};
+
 class Transcriber : public QObject {
     Q_OBJECT
 
@@ -85,6 +140,28 @@ public:
     void startTranscription();
     void abortTranscription();
     void setVideoInfo(const QString &title, const QString &link);
+    void setParams(const whisper_params &params);
+    void setPlacement(const WorkerPlacement &placement);
+
+    // short clips concatenated after the main file, separated by silence, and split
+    // back by timestamp so each still gets its own JSON
+    void setPackedClips(const QVector<packed_clip> &clips);
+
+    // draft pass, params.model is already the preview model; writes .preview.json
+    void setPreview(bool preview);
+
+    // model path as configured in whisper_params, resolved next to the executable
+    static QString modelPath(const whisper_params &params);
+
+    // starts loading the models jobs with these params will ask for first, in the background
+    static void preloadModels(const whisper_params &params);
+
+    // "greedy", "beam" or "adaptive" into beam_search/adaptive_beam, false for anything else
+    static bool setDecoding(whisper_params &params, const QString &decoding);
+
+    // encoder context for n_samples of audio: the explicit audio_ctx, or with auto_audio_ctx
+    // the input length plus margin when it is shorter than one window, 0 for the full window
+    static int audioCtxFor(struct whisper_context *ctx, size_t n_samples, const whisper_params &params);
 
 signals:
     void progressUpdated(int progress);
@@ -92,6 +169,9 @@ signals:
     void transcriptionFinished(bool aborted = false);
     void error(QString err);
     void totalProgressUpdated(int progress);
+    void clipStatusUpdated(int clip, const QString &status);
+    void clipFinished(int clip);
+    void outputWritten(int clip, const QString &file); // clip -1 is the main file
 
 private:
     QString file;
@@ -99,13 +179,47 @@ private:
     QString videoTitle;
     QString videoHrefLink;
     whisper_params params;
+    WorkerPlacement placement;
+    bool placementApplied = false;
+    int audioCtxUsed = 0;
+    bool modelResident = false; // the model was already loaded
+    qint64 modelLoadMs = 0;
+    int refinedSegments = 0;
+
+    // repetition guard, fed from the segment callback
+    bool loopGuard = false;
+    bool loopDetected = false;
+    int loopRepeats = 0;
+    int64_t loopStart = 0;
+    int64_t loopEnd = 0;
+    std::vector<std::string> recentSegments;
+
+    int languageId = -1; // detected or forced language when whisper_full did not run
+    QVector<packed_clip> packedClips;
+    bool preview = false;
+    QDateTime startedAt;
     std::atomic<bool>* abortFlag;
 
     void whisper_print_progress_callback(struct whisper_context * /*ctx*/, struct whisper_state * /*state*/, int progress, void * user_data);
-    void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * /*state*/, int n_new, void * user_data);
-    void extractAudio(const QString &inputFile, const QString &outputFile);
+    void whisper_print_segment_callback(struct whisper_context * ctx, struct whisper_state * state, int n_new, void * user_data);
+    bool extractAudio(const QString &inputFile, const QString &outputFile);
+    QString prepareAudio(const QString &inputFile, const QString &outputFolder);
+    ModelLease initContext();
+    whisper_full_params fullParams(struct whisper_context *ctx, size_t n_samples, struct whisper_print_user_data &user_data);
+    void checkRepetition(const std::string &text, int64_t t0, int64_t t1);
+    void routeLanguage(const std::vector<float> &pcmf32);
+    bool setMel(struct whisper_context *ctx, struct whisper_state *state, const std::vector<float> &pcmf32);
     void transcribeFile(const QString &wavFile, const QString &outputFile);
-    bool output_json(struct whisper_context * ctx, const char * fname, const whisper_params & params, std::vector<std::vector<float>> pcmf32s, bool full);
+    void transcribePacked();
+    static std::vector<transcript_segment> collectSegments(struct whisper_context *ctx, struct whisper_state *state);
+    void refineSegments(ModelLease &model, const whisper_full_params &wparams, const std::vector<float> &pcmf32,
+                        std::vector<transcript_segment> &segments);
+    QString outputPath(const QString &inputFile, const QString &outputFolder) const;
+    bool writeOutput(const ModelLease &model, const QString &outputFile, const std::vector<transcript_segment> &segments,
+                     const QString &title, const QString &link, int clip = -1, const std::vector<transcript_segment> *translation = nullptr);
+    void transcribeDual(const ModelLease &model, const std::vector<float> &pcmf32, const QString &outputFile);
+    bool output_json(struct whisper_context * ctx, struct whisper_state * state, const char * fname, const whisper_params & params, const std::vector<transcript_segment> & segments, bool full,
+                     const QString &title, const QString &link, const std::vector<transcript_segment> * translation = nullptr);
     void updateTotalProgress();
     int64_t get_current_timestamp_ms();
 };
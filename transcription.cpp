@@ -7,19 +7,20 @@ Transcription::Transcription(const QString &file, const QString &outputFolder, i
     transcriber->moveToThread(thread);
 
     connect(thread, &QThread::started, transcriber, [this, file, outputFolder, title, link]() {
+        transcriber->setParams(params);
+        transcriber->setPlacement(placement);
         transcriber->setFileAndOutput(file, outputFolder);
         transcriber->setVideoInfo(title, link);
+        transcriber->setPackedClips(packedClips);
+        transcriber->setPreview(preview);
         transcriber->startTranscription();
     });
 
-    connect(transcriber, &Transcriber::progressUpdated, this, [this, row](int progress) {
-        emit progressUpdated(row, progress);
-    });
-
-    connect(transcriber, &Transcriber::statusUpdated, this, [this, row](const QString &status) {
-        emit statusUpdated(row, status);
-    });
-
+    connect(transcriber, &Transcriber::progressUpdated, this, &Transcription::onProgressUpdated);
+    connect(transcriber, &Transcriber::statusUpdated, this, [this](const QString &status) { onStatusUpdated(-1, status); });
+    connect(transcriber, &Transcriber::clipStatusUpdated, this, &Transcription::onStatusUpdated);
+    connect(transcriber, &Transcriber::clipFinished, this, &Transcription::onClipFinished);
+    connect(transcriber, &Transcriber::outputWritten, this, &Transcription::onOutputWritten);
     connect(transcriber, &Transcriber::transcriptionFinished, this, &Transcription::onTranscriptionFinished);
     connect(transcriber, &Transcriber::transcriptionFinished, thread, &QThread::quit);
     connect(transcriber, &Transcriber::transcriptionFinished, transcriber, &Transcriber::deleteLater);
@@ -27,17 +28,73 @@ Transcription::Transcription(const QString &file, const QString &outputFolder, i
 }
 
 Transcription::~Transcription() {
-    //TODO double check if this is necessary
-    //delete thread;
-    // delete transcriber;
+    // a started transcriber and thread delete themselves once finished
+    if (!started) {
+        delete transcriber;
+        delete thread;
+    }
+}
+
+void Transcription::setParams(const whisper_params &params) {
+    this->params = params;
+}
+
+void Transcription::setPlacement(const WorkerPlacement &placement) {
+    this->placement = placement;
+}
+
+const WorkerPlacement &Transcription::getPlacement() const {
+    return placement;
+}
+
+void Transcription::setWorkerPool(WorkerPool *pool) {
+    workerPool = pool;
 }
 
 void Transcription::start() {
+    if (workerPool) {
+        startInWorker();
+        return;
+    }
+    started = true;
     thread->start();
 }
 
+// same job, run by a worker process; the unused thread and transcriber go with this object
+void Transcription::startInWorker() {
+    connect(workerPool, &WorkerPool::progressUpdated, this, [this](qint64 job, int progress) {
+        if (job == workerJob) onProgressUpdated(progress);
+    });
+    connect(workerPool, &WorkerPool::statusUpdated, this, [this](qint64 job, int clip, const QString &status) {
+        if (job == workerJob) onStatusUpdated(clip, status);
+    });
+    connect(workerPool, &WorkerPool::clipFinished, this, [this](qint64 job, int clip) {
+        if (job == workerJob) onClipFinished(clip);
+    });
+    connect(workerPool, &WorkerPool::outputWritten, this, [this](qint64 job, int clip, const QString &file) {
+        if (job == workerJob) onOutputWritten(clip, file);
+    });
+    connect(workerPool, &WorkerPool::jobFinished, this, [this](qint64 job, bool aborted) {
+        if (job == workerJob) onTranscriptionFinished(aborted);
+    });
+
+    WorkerJob job;
+    job.file = file;
+    job.outputFolder = outputFolder;
+    job.title = title;
+    job.link = link;
+    job.params = params;
+    job.placement = placement;
+    job.clips = packedClips;
+    job.preview = preview;
+    workerJob = workerPool->submit(job);
+}
+
 void Transcription::abort() {
     abortFlag.store(true); // Signal abort
+    if (workerPool && workerJob > 0) {
+        workerPool->abort(workerJob);
+    }
     emit statusUpdated(row, "Is Cancelling");
 }
 
@@ -45,10 +102,114 @@ int Transcription::getRow() const {
     return row;
 }
 
+QString Transcription::getFile() const {
+    return file;
+}
+
+void Transcription::absorb(const Transcription *other) {
+    packedClips.append({ other->file, other->outputFolder, other->title, other->link });
+    packedRows.append(other->row);
+    packedJobIds.append(other->jobId);
+    if (durationMs >= 0 && other->durationMs >= 0) {
+        durationMs += other->durationMs;
+    }
+}
+
+QVector<int> Transcription::getPackedRows() const {
+    return packedRows;
+}
+
+QVector<qint64> Transcription::getPackedJobIds() const {
+    return packedJobIds;
+}
+
+void Transcription::setJobId(qint64 id) {
+    jobId = id;
+}
+
+qint64 Transcription::getJobId() const {
+    return jobId;
+}
+
+bool Transcription::wroteOutput(int clip) const {
+    return writtenClips.contains(clip);
+}
+
+QString Transcription::getLastStatus() const {
+    return lastStatus;
+}
+
+void Transcription::setPreview(bool preview) {
+    this->preview = preview;
+}
+
+bool Transcription::isPreview() const {
+    return preview;
+}
+
+void Transcription::setModelVariant(const QString &variant) {
+    modelVariant = variant;
+}
+
+QString Transcription::getModelVariant() const {
+    return modelVariant;
+}
+
+void Transcription::setDurationMs(qint64 durationMs) {
+    this->durationMs = durationMs;
+}
+
+qint64 Transcription::getDurationMs() const {
+    return durationMs;
+}
+
+void Transcription::setPriority(int priority) {
+    this->priority = priority;
+}
+
+int Transcription::getPriority() const {
+    return priority;
+}
+
+void Transcription::setDeadline(const QDateTime &deadline) {
+    this->deadline = deadline;
+}
+
+QDateTime Transcription::getDeadline() const {
+    return deadline;
+}
+
 bool Transcription::isAborted() const {
     return abortFlag.load();
 }
 
+// the row's progress belongs to the full transcription, a preview only reports its status
+void Transcription::onProgressUpdated(int progress) {
+    if (!preview) {
+        emit progressUpdated(row, progress);
+    }
+}
+
+void Transcription::onStatusUpdated(int clip, const QString &status) {
+    if (clip < 0) {
+        lastStatus = status;
+    }
+    emit statusUpdated(clip < 0 ? row : packedRows.value(clip), preview ? "Preview: " + status : status);
+}
+
+void Transcription::onClipFinished(int clip) {
+    if (!preview) {
+        emit progressUpdated(packedRows.value(clip), 100);
+    }
+}
+
+void Transcription::onOutputWritten(int clip, const QString &file) {
+    writtenClips.append(clip);
+    if (preview) {
+        emit previewReady(clip < 0 ? row : packedRows.value(clip), file);
+    }
+}
+
 void Transcription::onTranscriptionFinished(bool aborted) {
     emit transcriptionFinished(row, aborted);
 }
@@ -2,9 +2,11 @@
 #define TRANSCRIPTION_H
 
 #include <QObject>
+#include <QDateTime>
 #include <QThread>
 #include <atomic>
 #include "transcriber.h"
+#include "workerpool.h"
 
 class Transcription : public QObject {
     Q_OBJECT
@@ -12,25 +14,84 @@ class Transcription : public QObject {
 public:
     Transcription(const QString &file, const QString &outputFolder, int row, const QString &title, const QString &link, QObject *parent = nullptr);
     ~Transcription();
+    void setParams(const whisper_params &params);
+    void setPlacement(const WorkerPlacement &placement);
+    const WorkerPlacement &getPlacement() const;
     void start();
     void abort();
+
+    // run in one of the pool's worker processes instead of a thread of this process
+    void setWorkerPool(WorkerPool *pool);
     int getRow() const;
+    QString getFile() const;
+
+    // transcribe other's file in the same window as this one, other is not started afterwards
+    void absorb(const Transcription *other);
+    QVector<int> getPackedRows() const;
+    QVector<qint64> getPackedJobIds() const;
+
+    // journal id, 0 for jobs that are not journaled (previews)
+    void setJobId(qint64 id);
+    qint64 getJobId() const;
+
+    // whether the JSON of the main file (clip -1) or a packed clip was written, and the last status
+    bool wroteOutput(int clip) const;
+    QString getLastStatus() const;
+
+    // quick draft with the preview model, runs ahead of the full transcriptions
+    void setPreview(bool preview);
+    bool isPreview() const;
+
+    // quantized model variant for this job, empty = the queue's default
+    void setModelVariant(const QString &variant);
+    QString getModelVariant() const;
+
+    // scheduling attributes, see TranscriptionQueueManager::SchedulingPolicy
+    void setDurationMs(qint64 durationMs);
+    qint64 getDurationMs() const;
+    void setPriority(int priority);
+    int getPriority() const;
+    void setDeadline(const QDateTime &deadline);
+    QDateTime getDeadline() const;
     bool isAborted() const;
 
 signals:
     void progressUpdated(int row, int progress);
     void statusUpdated(int row, const QString &status);
     void transcriptionFinished(int row, bool aborted);
+    void previewReady(int row, const QString &file);
 
 private slots:
+    void onProgressUpdated(int progress);
+    void onStatusUpdated(int clip, const QString &status); // clip -1 is the main file
+    void onClipFinished(int clip);
+    void onOutputWritten(int clip, const QString &file);
     void onTranscriptionFinished(bool aborted);
 
 private:
+    void startInWorker();
+
     QString file;
     QString outputFolder;
     int row;
     QString title;
     QString link;
+    whisper_params params;
+    WorkerPlacement placement;
+    qint64 durationMs = -1;
+    int priority = 0;
+    QDateTime deadline;
+    QVector<packed_clip> packedClips;
+    QVector<int> packedRows;
+    QVector<qint64> packedJobIds;
+    qint64 jobId = 0;
+    QVector<int> writtenClips;
+    QString lastStatus;
+    bool started = false;
+    bool preview = false;
+    QString modelVariant;
+    WorkerPool *workerPool = nullptr;
+    qint64 workerJob = 0;
     QThread *thread;
     Transcriber *transcriber;
     std::atomic<bool> abortFlag; // Use atomic to safely signal abort
@@ -1,56 +1,439 @@
 #include "transcriptionqueuemanager.h"
+#include "threadtuner.h"
+#include "mediaprobe.h"
+#include "hardwareinfo.h"
+
+#include <QFileInfo>
+
+#include <QDebug>
 
 TranscriptionQueueManager::TranscriptionQueueManager(QObject *parent)
     : QObject(parent) {}
 
-void TranscriptionQueueManager::addTranscription(const QString &file, const QString &outputFolder, int row, const QString &title, const QString &link) {
+Transcription *TranscriptionQueueManager::createTranscription(const QString &file, const QString &outputFolder, int row, const QString &title,
+                                                              const QString &link, int priority, const QDateTime &deadline) {
     Transcription *transcription = new Transcription(file, outputFolder, row, title, link, this);
+    transcription->setDurationMs(MediaProbe::durationMs(file));
+    transcription->setPriority(priority);
+    transcription->setDeadline(deadline);
     connect(transcription, &Transcription::progressUpdated, this, &TranscriptionQueueManager::progressUpdated);
+    connect(transcription, &Transcription::progressUpdated, this, [this, transcription](int /*row*/, int progress) {
+        if (journal && transcription->getJobId() > 0) {
+            journal->checkpointed(transcription->getJobId(), progress);
+        }
+    });
     connect(transcription, &Transcription::statusUpdated, this, &TranscriptionQueueManager::statusUpdated);
+    connect(transcription, &Transcription::previewReady, this, &TranscriptionQueueManager::previewReady);
     connect(transcription, &Transcription::transcriptionFinished, this, &TranscriptionQueueManager::onTranscriptionFinished);
-    queue.enqueue(transcription);
+    return transcription;
+}
+
+void TranscriptionQueueManager::addTranscription(const QString &file, const QString &outputFolder, int row, const QString &title, const QString &link,
+                                                 int priority, const QDateTime &deadline, const QString &modelVariant) {
+    JournalJob job;
+    job.file = file;
+    job.outputFolder = outputFolder;
+    job.row = row;
+    job.title = title;
+    job.link = link;
+    job.priority = priority;
+    job.deadline = deadline;
+    job.modelVariant = modelVariant;
+    if (journal) {
+        job.id = journal->nextId();
+        journal->enqueued(job);
+    }
+    enqueue(job);
+}
+
+void TranscriptionQueueManager::enqueue(const JournalJob &job) {
+    if (!params.preview_model.empty()) {
+        Transcription *preview = createTranscription(job.file, job.outputFolder, job.row, job.title, job.link, job.priority, job.deadline);
+        preview->setPreview(true);
+        queue.append(preview);
+    }
+    Transcription *transcription = createTranscription(job.file, job.outputFolder, job.row, job.title, job.link, job.priority, job.deadline);
+    transcription->setModelVariant(job.modelVariant);
+    transcription->setJobId(job.id);
+    queue.append(transcription);
+}
+
+void TranscriptionQueueManager::enableJournal(const QString &path) {
+    if (!journal) {
+        journal = new JobJournal(path, this);
+    }
+}
+
+QVector<JournalJob> TranscriptionQueueManager::restoreJournal() {
+    QVector<JournalJob> jobs;
+    if (!journal) {
+        return jobs;
+    }
+    jobs = journal->replay();
+    for (int i = 0; i < jobs.size(); ++i) {
+        jobs[i].row = i;
+        // whisper cannot resume mid-file, an interrupted job starts over
+        qInfo() << "journal: restoring" << jobs[i].file << (jobs[i].started ? QString("interrupted at %1%").arg(jobs[i].progress) : "queued");
+        enqueue(jobs[i]);
+    }
+    return jobs;
+}
+
+void TranscriptionQueueManager::setParams(const whisper_params &params) {
+    this->params = params;
+}
+
+const whisper_params &TranscriptionQueueManager::getParams() const {
+    return params;
+}
+
+void TranscriptionQueueManager::setAutoTune(bool enabled) {
+    autoTune = enabled;
+}
+
+void TranscriptionQueueManager::setMaxConcurrentJobs(int jobs) {
+    maxConcurrentJobs = qMax(1, jobs);
+}
+
+int TranscriptionQueueManager::getMaxConcurrentJobs() const {
+    return maxConcurrentJobs;
+}
+
+void TranscriptionQueueManager::setSchedulingPolicy(SchedulingPolicy policy) {
+    schedulingPolicy = policy;
+}
+
+bool TranscriptionQueueManager::runsBefore(const Transcription *a, const Transcription *b) const {
+    // drafts are what editors wait for, all of them go before any full transcription
+    if (a->isPreview() != b->isPreview()) {
+        return a->isPreview();
+    }
+
+    if (a->getPriority() != b->getPriority()) {
+        return a->getPriority() > b->getPriority();
+    }
+
+    const QDateTime deadlineA = a->getDeadline();
+    const QDateTime deadlineB = b->getDeadline();
+    if (deadlineA.isValid() != deadlineB.isValid()) {
+        return deadlineA.isValid();
+    }
+    if (deadlineA.isValid() && deadlineA != deadlineB) {
+        return deadlineA < deadlineB;
+    }
+
+    // unknown durations keep their submission order behind the probed ones
+    const qint64 durationA = a->getDurationMs();
+    const qint64 durationB = b->getDurationMs();
+    if (schedulingPolicy != Fifo && (durationA < 0) != (durationB < 0)) {
+        return durationA >= 0;
+    }
+    if (schedulingPolicy == LongestFirst && durationA != durationB) {
+        return durationA > durationB;
+    }
+    if (schedulingPolicy == ShortestFirst && durationA != durationB) {
+        return durationA < durationB;
+    }
+    return false;
+}
+
+int TranscriptionQueueManager::nextTranscriptionIndex() const {
+    // queue is in submission order, the first of equally ranked jobs wins
+    int next = 0;
+    for (int i = 1; i < queue.size(); ++i) {
+        if (runsBefore(queue.at(i), queue.at(next))) {
+            next = i;
+        }
+    }
+    return next;
+}
+
+void TranscriptionQueueManager::setMemoryBudget(qint64 bytes) {
+    memoryBudget = bytes;
+}
+
+qint64 TranscriptionQueueManager::getMemoryBudget() const {
+    if (memoryBudget > 0) {
+        return memoryBudget;
+    }
+    return HardwareInfo::physicalMemoryBytes() / 10 * 8;
+}
+
+qint64 TranscriptionQueueManager::estimateJobBytes(qint64 durationMs, qint64 modelBytes) {
+    // length unknown until decoded: plan for an hour of audio
+    const qint64 seconds = durationMs >= 0 ? durationMs / 1000 + 1 : 3600;
+    // float mono PCM plus the 16-bit copy and stereo/raw data alive while reading the WAV
+    const qint64 pcmBytes = seconds * WHISPER_SAMPLE_RATE * 8;
+    // KV caches and compute buffers grow with the model, roughly a quarter of its weights
+    const qint64 stateBytes = modelBytes / 4 + 64ll * 1024 * 1024;
+    return pcmBytes + stateBytes;
+}
+
+// weights of the running jobs' models (and extraPath) that the model manager has not loaded yet
+qint64 TranscriptionQueueManager::pendingModelBytes(const QString &extraPath, qint64 extraBytes) const {
+    const ModelManager &manager = ModelManager::instance();
+    QMap<QString, qint64> pending;
+    for (const auto &model : reservedModels) {
+        pending.insert(model.first, model.second);
+    }
+    pending.insert(extraPath, extraBytes);
+
+    qint64 bytes = 0;
+    for (auto it = pending.constBegin(); it != pending.constEnd(); ++it) {
+        if (!manager.contains(it.key(), params.use_gpu)) {
+            bytes += it.value();
+        }
+    }
+    return bytes;
+}
+
+bool TranscriptionQueueManager::admit(Transcription *transcription, qint64 estimate, const QString &modelPath, qint64 modelBytes) {
+    const int row = transcription->getRow();
+    const qint64 budget = getMemoryBudget();
+    const qint64 resident = HardwareInfo::residentMemoryBytes();
+
+    qint64 reserved = 0;
+    for (qint64 bytes : reservedBytes) {
+        reserved += bytes;
+    }
+    // models kept between jobs count once, plus whatever this or a running job still has to load
+    const qint64 models = ModelManager::instance().committedBytes();
+    const qint64 loading = pendingModelBytes(modelPath, modelBytes);
+    const qint64 alreadyLoading = pendingModelBytes(QString(), 0);
+    estimate += loading - alreadyLoading;
+
+    // running jobs may not have allocated everything yet, trust whichever is larger
+    const qint64 committed = qMax(resident, baselineResidentBytes + models + alreadyLoading + reserved);
+    const qint64 mb = 1024 * 1024;
+
+    if (budget <= 0 || committed + estimate <= budget) {
+        emit statusUpdated(row, QString("Admitted (~%1 MB)").arg(estimate / mb));
+        return true;
+    }
+    if (reservedBytes.isEmpty()) {
+        // never stall the queue, a single job has to run even if it does not fit
+        emit statusUpdated(row, QString("Admitted over budget (~%1 MB of %2 MB)").arg(estimate / mb).arg(budget / mb));
+        return true;
+    }
+
+    emit statusUpdated(row, QString("Waiting for memory (~%1 MB needed, %2 MB free of %3 MB)")
+                                .arg(estimate / mb).arg(qMax<qint64>(0, budget - committed) / mb).arg(budget / mb));
+    qInfo("queue: row %d deferred, estimate %lld MB, committed %lld MB, budget %lld MB", row, estimate / mb, committed / mb, budget / mb);
+    return false;
+}
+
+void TranscriptionQueueManager::setClipPacking(bool enabled, qint64 maxClipMs) {
+    clipPacking = enabled;
+    maxPackedClipMs = maxClipMs;
+}
+
+bool TranscriptionQueueManager::isPackable(const Transcription *transcription) const {
+    // an offset or duration would cut into the neighbouring clips, and
+    // clips of possibly different languages cannot share one decoding
+    const qint64 durationMs = transcription->getDurationMs();
+    return clipPacking && params.offset_t_ms == 0 && params.duration_ms == 0
+        && !params.detect_language && params.language != "auto"
+        && durationMs >= 0 && durationMs <= maxPackedClipMs;
+}
+
+void TranscriptionQueueManager::packClips(Transcription *transcription) {
+    // clips plus 1.5 s silence separators have to stay within one encoder window
+    const qint64 windowMs = 28000;
+    const qint64 gapMs = 1500;
+    const int maxClips = 8;
+
+    if (!isPackable(transcription)) {
+        return;
+    }
+    // a job deferred by admission comes through here again, with the clips it already holds
+    qint64 usedMs = transcription->getDurationMs() + gapMs * transcription->getPackedRows().size();
+    for (int i = 0; i < queue.size() && transcription->getPackedRows().size() + 1 < maxClips;) {
+        Transcription *candidate = queue.at(i);
+        if (candidate == transcription || !isPackable(candidate) || candidate->isPreview() != transcription->isPreview()
+            || candidate->getPriority() != transcription->getPriority()
+            || candidate->getModelVariant() != transcription->getModelVariant()
+            || usedMs + gapMs + candidate->getDurationMs() > windowMs) {
+            ++i;
+            continue;
+        }
+        usedMs += gapMs + candidate->getDurationMs();
+        transcription->absorb(candidate);
+        queue.removeAt(i);
+        qInfo() << "queue: row" << candidate->getRow() << "packed with row" << transcription->getRow();
+        candidate->deleteLater();
+    }
+}
+
+void TranscriptionQueueManager::setPinWorkers(bool enabled) {
+    pinWorkers = enabled;
+}
+
+void TranscriptionQueueManager::setWorkerProcesses(bool enabled) {
+    workerProcesses = enabled;
+}
+
+void TranscriptionQueueManager::releasePlacement(Transcription *transcription) {
+    placementPlanner.release(transcription->getPlacement());
+    transcription->setPlacement(WorkerPlacement());
+}
+
+void TranscriptionQueueManager::applyTuning() {
+    if (!autoTune) {
+        return;
+    }
+    const TuningResult tuning = ThreadTuner::load(params);
+    maxConcurrentJobs = tuning.jobs;
+    params.n_threads = tuning.threads;
+    qInfo("queue: %d concurrent job(s) x %d thread(s)%s", tuning.jobs, tuning.threads, tuning.calibrated ? " (calibrated)" : "");
 }
 
 void TranscriptionQueueManager::start() {
-    if (!queue.isEmpty()) {
-        startNextTranscription();
+    applyTuning();
+    if (workerProcesses && !workerPool) {
+        // one worker per concurrent job, each keeps its model loaded between jobs
+        workerPool = new WorkerPool(maxConcurrentJobs, params, this);
+    }
+    if (reservedBytes.isEmpty()) {
+        // without the resident models, admit() counts those itself
+        baselineResidentBytes = qMax<qint64>(0, HardwareInfo::residentMemoryBytes() - ModelManager::instance().committedBytes());
+    }
+    startQueuedTranscriptions();
+}
+
+void TranscriptionQueueManager::startQueuedTranscriptions() {
+    while (!queue.isEmpty() && activeTranscriptions.size() < maxConcurrentJobs) {
+        if (!startNextTranscription()) {
+            break;
+        }
     }
 }
 
 void TranscriptionQueueManager::stopAllThreads() {
     while (!activeTranscriptions.isEmpty()) {
-        auto transcription = activeTranscriptions.begin().value();
+        auto transcription = activeTranscriptions.takeFirst();
         transcription->abort();
-        activeTranscriptions.erase(activeTranscriptions.begin());
+        stoppingTranscriptions.append(transcription);
+    }
+    if (journal) {
+        for (const auto *transcription : queue) {
+            journal->failed(transcription->getJobId(), "cancelled");
+        }
     }
     queue.clear();
 }
 
 void TranscriptionQueueManager::stopCurrentThread() {
     if (!activeTranscriptions.isEmpty()) {
-        auto transcription = activeTranscriptions.begin().value();
+        auto transcription = activeTranscriptions.takeFirst();
         transcription->abort();
-        activeTranscriptions.erase(activeTranscriptions.begin());
-        startNextTranscription();
+        stoppingTranscriptions.append(transcription);
+        startQueuedTranscriptions();
     }
 }
 
-void TranscriptionQueueManager::onTranscriptionFinished(int row, bool aborted) {
-    auto transcription = activeTranscriptions.take(row);
-    transcription->deleteLater();
+void TranscriptionQueueManager::onTranscriptionFinished(int /*row*/, bool aborted) {
+    // aborted transcriptions were moved from the active set to the stopping one
+    auto transcription = qobject_cast<Transcription *>(sender());
+    if (journal && !transcription->isPreview()) {
+        // a job without output failed for good (unreadable file, damaged model), do not retry it on restart
+        const QVector<qint64> packed = transcription->getPackedJobIds();
+        for (int clip = -1; clip < packed.size(); ++clip) {
+            const qint64 id = clip < 0 ? transcription->getJobId() : packed.at(clip);
+            if (aborted || transcription->isAborted()) {
+                journal->failed(id, "aborted");
+            } else if (transcription->wroteOutput(clip)) {
+                journal->finished(id);
+            } else {
+                journal->failed(id, clip < 0 ? transcription->getLastStatus() : QString("no output"));
+            }
+        }
+    }
+    reservedBytes.remove(transcription);
+    reservedModels.remove(transcription);
+    // the cores stay taken until the aborted thread is actually done with them
+    if (activeTranscriptions.removeOne(transcription) || stoppingTranscriptions.removeOne(transcription)) {
+        releasePlacement(transcription);
+        transcription->deleteLater();
+    }
 
-    if (queue.isEmpty() && activeTranscriptions.isEmpty()) {
+    if (queue.isEmpty() && activeTranscriptions.isEmpty() && stoppingTranscriptions.isEmpty()) {
+        const ModelStats stats = ModelManager::instance().stats();
+        qInfo("queue: done, models %lld hits %lld misses %lld evictions, %lld ms loading, %d resident (%lld MB)", (long long) stats.hits,
+              (long long) stats.misses, (long long) stats.evictions, (long long) stats.loadMs, stats.resident, (long long) (stats.residentBytes >> 20));
         emit allThreadsFinished();
     } else {
-        startNextTranscription();
+        startQueuedTranscriptions();
+    }
+}
+
+qint64 TranscriptionQueueManager::modelBytesFor(const whisper_params &jobParams, bool preview) const {
+    qint64 bytes = QFileInfo(Transcriber::modelPath(jobParams)).size();
+    if (preview || !(jobParams.detect_language || jobParams.language == "auto")) {
+        return bytes;
     }
+    // the language is only known once the job runs, plan for the largest model it may be routed to
+    for (const auto &entry : jobParams.language_models) {
+        whisper_params routed = jobParams;
+        routed.model = entry.second;
+        bytes = qMax(bytes, QFileInfo(Transcriber::modelPath(routed)).size());
+    }
+    return bytes;
+}
+
+whisper_params TranscriptionQueueManager::paramsFor(const Transcription *transcription) const {
+    whisper_params result = params;
+    if (transcription->isPreview()) {
+        // speed over everything, the full transcription follows
+        result.model = params.preview_model;
+        result.model_variant.clear();
+        result.adaptive_beam = false;
+        result.dual_output = false;
+    } else if (!transcription->getModelVariant().isEmpty()) {
+        // "f16" asks for the original model explicitly
+        const QString variant = transcription->getModelVariant();
+        result.model_variant = variant == "f16" ? std::string() : variant.toStdString();
+    }
+    return result;
 }
 
-void TranscriptionQueueManager::startNextTranscription() {
+bool TranscriptionQueueManager::startNextTranscription() {
     if (!queue.isEmpty()) {
-        Transcription *transcription = queue.dequeue();
+        Transcription *transcription = queue.at(nextTranscriptionIndex());
+        packClips(transcription);
+        whisper_params jobParams = paramsFor(transcription);
+        const qint64 modelBytes = modelBytesFor(jobParams, transcription->isPreview());
+        const qint64 estimate = estimateJobBytes(transcription->getDurationMs(), modelBytes);
+        const QString modelPath = Transcriber::modelPath(jobParams);
+        if (!admit(transcription, estimate, modelPath, modelBytes)) {
+            return false;
+        }
+
+        queue.removeOne(transcription);
         int row = transcription->getRow();
-        activeTranscriptions.insert(row, transcription);
+        reservedBytes.insert(transcription, estimate);
+        reservedModels.insert(transcription, qMakePair(modelPath, modelBytes));
+        activeTranscriptions.append(transcription);
+        qInfo() << "queue: starting row" << row << (transcription->isPreview() ? "preview" : "") << "duration" << transcription->getDurationMs()
+                << "ms priority" << transcription->getPriority();
+
+        if (pinWorkers) {
+            const WorkerPlacement placement = placementPlanner.acquire(params.n_threads);
+            if (placement.isValid()) {
+                jobParams.n_threads = qMin(params.n_threads, int(placement.cpus.size()));
+                transcription->setPlacement(placement);
+            }
+            qInfo() << "queue: row" << row << "placed on node" << placement.node << "cpus" << placement.cpuList();
+        }
+        transcription->setParams(jobParams);
+        transcription->setWorkerPool(workerPool);
         transcription->start();
+        if (journal && !transcription->isPreview()) {
+            journal->started(transcription->getJobId());
+            for (qint64 id : transcription->getPackedJobIds()) {
+                journal->started(id);
+            }
+        }
+        return true;
     }
+    return false;
 }
@@ -2,34 +2,110 @@
 #define TRANSCRIPTIONQUEUEMANAGER_H
 
 #include <QObject>
-#include <QQueue>
+#include <QList>
 #include <QMap>
+#include <QPair>
 #include "transcription.h"
+#include "jobjournal.h"
 
 class TranscriptionQueueManager : public QObject
 {
     Q_OBJECT
 
 public:
+    // order among jobs of equal priority; jobs with a deadline always go earliest-deadline-first
+    enum SchedulingPolicy {
+        Fifo,           // submission order
+        LongestFirst,   // longest processing time first, minimizes batch makespan with concurrent jobs
+        ShortestFirst   // shortest first, minimizes mean latency for interactive use
+    };
+
     explicit TranscriptionQueueManager(QObject *parent = nullptr);
-    void addTranscription(const QString &file, const QString &outputFolder, int row, const QString &title, const QString &link);
+    // with params.preview_model set, a preview job for the file is queued as well
+    void addTranscription(const QString &file, const QString &outputFolder, int row, const QString &title, const QString &link,
+                          int priority = 0, const QDateTime &deadline = QDateTime(), const QString &modelVariant = QString());
     void start();
     void stopAllThreads();
     void stopCurrentThread();
 
+    // parameters applied to every transcription added afterwards
+    void setParams(const whisper_params &params);
+    const whisper_params &getParams() const;
+
+    // use the calibrated (or topology based) jobs x threads split for the model, on by default
+    void setAutoTune(bool enabled);
+    void setMaxConcurrentJobs(int jobs);
+    int getMaxConcurrentJobs() const;
+
+    // pin each running job to its own cores, and to a single node on NUMA hosts
+    void setPinWorkers(bool enabled);
+
+    void setSchedulingPolicy(SchedulingPolicy policy);
+
+    // jobs are only started while their estimated footprint fits, 0 = 80% of physical memory
+    void setMemoryBudget(qint64 bytes);
+    qint64 getMemoryBudget() const;
+
+    // run queued clips up to maxClipMs long together in one 30 s window, off by default
+    void setClipPacking(bool enabled, qint64 maxClipMs = 10000);
+
+    // run jobs in child processes so a crash costs one file instead of the queue, off by default
+    void setWorkerProcesses(bool enabled);
+
+    // record job lifecycle events so the queue survives a crash or restart, off by default
+    void enableJournal(const QString &path = JobJournal::defaultPath());
+
+    // queues the jobs the journal left unfinished, on rows 0..n-1, and returns them
+    QVector<JournalJob> restoreJournal();
+
+    // PCM buffers and decoder state for one job of the given length; the weights are shared
+    // between jobs and charged once per model in admit()
+    static qint64 estimateJobBytes(qint64 durationMs, qint64 modelBytes);
+
 signals:
     void allThreadsFinished();
     void progressUpdated(int row, int progress);
     void statusUpdated(int row, const QString &status);
+    void previewReady(int row, const QString &file);
 
 private slots:
     void onTranscriptionFinished(int row, bool aborted);
 
 private:
-    void startNextTranscription();
+    void startQueuedTranscriptions();
+    bool startNextTranscription();
+    int nextTranscriptionIndex() const;
+    bool admit(Transcription *transcription, qint64 estimate, const QString &modelPath, qint64 modelBytes);
+    qint64 pendingModelBytes(const QString &extraPath, qint64 extraBytes) const;
+    bool runsBefore(const Transcription *a, const Transcription *b) const;
+    bool isPackable(const Transcription *transcription) const;
+    void packClips(Transcription *transcription);
+    void applyTuning();
+    void enqueue(const JournalJob &job);
+    Transcription *createTranscription(const QString &file, const QString &outputFolder, int row, const QString &title, const QString &link,
+                                       int priority, const QDateTime &deadline);
+    whisper_params paramsFor(const Transcription *transcription) const;
+    qint64 modelBytesFor(const whisper_params &jobParams, bool preview) const;
+    void releasePlacement(Transcription *transcription);
 
-    QQueue<Transcription*> queue;
-    QMap<int, Transcription*> activeTranscriptions;
+    QList<Transcription*> queue;
+    QList<Transcription*> activeTranscriptions; // a row's preview and full job may run together
+    QList<Transcription*> stoppingTranscriptions; // aborted, placement held until their thread finishes
+    whisper_params params;
+    bool autoTune = true;
+    int maxConcurrentJobs = 1;
+    bool pinWorkers = false;
+    SchedulingPolicy schedulingPolicy = Fifo;
+    qint64 memoryBudget = 0;
+    bool clipPacking = false;
+    qint64 maxPackedClipMs = 10000;
+    qint64 baselineResidentBytes = 0;
+    QMap<Transcription*, qint64> reservedBytes; // per job, held until its thread is done
+    QMap<Transcription*, QPair<QString, qint64>> reservedModels; // model path and size per running job
+    WorkerPlacementPlanner placementPlanner;
+    JobJournal *journal = nullptr;
+    bool workerProcesses = false;
+    WorkerPool *workerPool = nullptr;
 };
 
 #endif // TRANSCRIPTIONQUEUEMANAGER_H
@@ -0,0 +1,139 @@
+#include "workerplacement.h"
+
+#include <QDebug>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+QString WorkerPlacement::cpuList() const {
+    QStringList list;
+    for (int cpu : cpus) {
+        list << QString::number(cpu);
+    }
+    return list.join(',');
+}
+
+WorkerPlacementPlanner::WorkerPlacementPlanner()
+    : topology(HardwareInfo::cpuTopology()) {
+    int maxCpu = 0;
+    for (const auto &siblings : topology.cores) {
+        for (int cpu : siblings) {
+            maxCpu = qMax(maxCpu, cpu);
+        }
+    }
+    busy.fill(false, maxCpu + 1);
+}
+
+WorkerPlacement WorkerPlacementPlanner::acquire(int threads) {
+    QMutexLocker locker(&mutex);
+
+    WorkerPlacement best;
+    for (int node = 0; node < topology.nodes.size(); ++node) {
+        const auto &nodeCpus = topology.nodes[node];
+
+        // one thread per free physical core first, SMT siblings only when cores run out
+        QVector<int> primary;
+        QVector<int> siblings;
+        for (const auto &core : topology.cores) {
+            if (core.isEmpty() || !nodeCpus.contains(core.first())) {
+                continue;
+            }
+            bool coreFree = true;
+            for (int cpu : core) {
+                coreFree = coreFree && !busy.value(cpu, true);
+            }
+            if (!coreFree) {
+                continue;
+            }
+            primary.append(core.first());
+            siblings += core.mid(1);
+        }
+
+        WorkerPlacement candidate;
+        candidate.node = node;
+        candidate.cpus = primary.mid(0, threads);
+        if (candidate.cpus.size() < threads) {
+            candidate.cpus += siblings.mid(0, threads - candidate.cpus.size());
+        } else {
+            // keep the siblings of the reserved cores away from other jobs
+            for (const auto &core : topology.cores) {
+                if (!core.isEmpty() && candidate.cpus.contains(core.first())) {
+                    candidate.cpus += core.mid(1);
+                }
+            }
+        }
+
+        // the first node that fits wins, otherwise the one with the most room
+        if (candidate.cpus.size() >= threads) {
+            best = candidate;
+            break;
+        }
+        if (candidate.cpus.size() > best.cpus.size()) {
+            best = candidate;
+        }
+    }
+
+    for (int cpu : best.cpus) {
+        busy[cpu] = true;
+    }
+    if (topology.nodes.size() <= 1) {
+        best.node = best.isValid() ? 0 : -1;
+    }
+    return best;
+}
+
+void WorkerPlacementPlanner::release(const WorkerPlacement &placement) {
+    QMutexLocker locker(&mutex);
+    for (int cpu : placement.cpus) {
+        if (cpu >= 0 && cpu < busy.size()) {
+            busy[cpu] = false;
+        }
+    }
+}
+
+bool WorkerPlacementPlanner::apply(const WorkerPlacement &placement) {
+    if (!placement.isValid()) {
+        return false;
+    }
+
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : placement.cpus) {
+        CPU_SET(cpu, &set);
+    }
+    // threads created from here on (the ggml workers) inherit the mask
+    if (sched_setaffinity(0, sizeof(set), &set) != 0) {
+        qWarning() << "placement: failed to pin thread to cpus" << placement.cpuList();
+        return false;
+    }
+
+    // first-touch already keeps memory local, this also covers allocations that spill over
+    if (placement.node >= 0 && placement.node < 64) {
+        unsigned long nodemask = 1UL << placement.node;
+        if (syscall(SYS_set_mempolicy, MPOL_PREFERRED, &nodemask, sizeof(nodemask) * 8) != 0) {
+            qWarning() << "placement: failed to prefer memory of node" << placement.node;
+        }
+    }
+    return true;
+#elif defined(_WIN32)
+    DWORD_PTR mask = 0;
+    for (int cpu : placement.cpus) {
+        if (cpu < int(sizeof(DWORD_PTR) * 8)) {
+            mask |= DWORD_PTR(1) << cpu;
+        }
+    }
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    // no hard affinity on macOS, the scheduler keeps the placement as a hint only
+    return false;
+#endif
+}
@@ -0,0 +1,36 @@
+#ifndef WORKERPLACEMENT_H
+#define WORKERPLACEMENT_H
+
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include "hardwareinfo.h"
+
+// cpus (and NUMA node) reserved for the thread group of one transcription
+struct WorkerPlacement {
+    int node = -1;
+    QVector<int> cpus;
+
+    bool isValid() const { return !cpus.isEmpty(); }
+    QString cpuList() const;
+};
+
+// Hands out disjoint core sets to concurrent transcriptions, keeping each one on a single node.
+class WorkerPlacementPlanner {
+public:
+    WorkerPlacementPlanner();
+
+    // reserve cores for a job running n threads, invalid when nothing is free
+    WorkerPlacement acquire(int threads);
+    void release(const WorkerPlacement &placement);
+
+    // pin the calling thread (and the ggml threads it spawns) and prefer memory from the node
+    static bool apply(const WorkerPlacement &placement);
+
+private:
+    CpuTopology topology;
+    QVector<bool> busy; // indexed by logical cpu id
+    QMutex mutex;
+};
+
+#endif // WORKERPLACEMENT_H
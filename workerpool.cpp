@@ -0,0 +1,251 @@
+#include "workerpool.h"
+#include "workerprotocol.h"
+
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QLocalSocket>
+#include <QTimer>
+#include <QDebug>
+
+WorkerPool::WorkerPool(int count, const whisper_params &params, QObject *parent)
+    : QObject(parent), params(params) {
+    // unique per supervisor, several instances may run side by side
+    const QString name = QString("VideoTranscriber-%1").arg(QCoreApplication::applicationPid());
+    QLocalServer::removeServer(name);
+    server.setSocketOptions(QLocalServer::UserAccessOption);
+    if (!server.listen(name)) {
+        qWarning() << "workers: cannot listen on" << name << server.errorString();
+    }
+    connect(&server, &QLocalServer::newConnection, this, &WorkerPool::onNewConnection);
+
+    for (int i = 0; i < qMax(1, count); ++i) {
+        Worker *worker = new Worker;
+        workers.append(worker);
+        spawn(worker);
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    shuttingDown = true;
+    for (auto *worker : workers) {
+        // closing the connection tells the worker to exit
+        if (worker->socket) {
+            worker->socket->disconnectFromServer();
+        }
+        if (worker->process && !worker->process->waitForFinished(3000)) {
+            worker->process->kill();
+            worker->process->waitForFinished(1000);
+        }
+        delete worker->process;
+        delete worker;
+    }
+}
+
+void WorkerPool::spawn(Worker *worker) {
+    delete worker->process;
+    worker->process = new QProcess(this);
+    worker->process->setProcessChannelMode(QProcess::ForwardedChannels);
+    connect(worker->process, QOverload<int, QProcess::ExitStatus>::of(&QProcess::finished), this, [this, worker]() { onExited(worker); });
+    // a process that never started does not emit finished
+    connect(worker->process, &QProcess::errorOccurred, this, [this, worker](QProcess::ProcessError error) {
+        if (error == QProcess::FailedToStart) {
+            onExited(worker);
+        }
+    });
+    worker->process->start(QCoreApplication::applicationFilePath(), QStringList() << "--worker" << server.serverName());
+    qInfo() << "workers: started" << worker->process->processId();
+}
+
+void WorkerPool::onNewConnection() {
+    while (QLocalSocket *socket = server.nextPendingConnection()) {
+        connect(socket, &QLocalSocket::readyRead, this, [this, socket]() { onReadyRead(socket); });
+        connect(socket, &QLocalSocket::disconnected, this, [this, socket]() {
+            handshakes.remove(socket);
+            for (auto *worker : workers) {
+                if (worker->socket == socket) {
+                    worker->socket = nullptr;
+                }
+            }
+            socket->deleteLater();
+        });
+    }
+}
+
+void WorkerPool::onReadyRead(QLocalSocket *socket) {
+    Worker *owner = nullptr;
+    for (auto *worker : workers) {
+        if (worker->socket == socket) {
+            owner = worker;
+        }
+    }
+    // a connection belongs to no worker until its hello names the process
+    QByteArray *buffer = owner ? &owner->buffer : &handshakes[socket];
+    buffer->append(socket->readAll());
+
+    QJsonObject message;
+    while (WorkerProtocol::next(*buffer, message)) {
+        if (owner) {
+            onMessage(owner, message);
+            continue;
+        }
+        const qint64 pid = qint64(message["pid"].toDouble());
+        for (auto *worker : workers) {
+            if (message["type"].toString() == "hello" && worker->process && worker->process->processId() == pid) {
+                owner = worker;
+            }
+        }
+        if (!owner) {
+            qWarning() << "workers: unexpected connection from process" << pid;
+            handshakes.remove(socket);
+            socket->disconnectFromServer();
+            return;
+        }
+        owner->socket = socket;
+        owner->buffer = handshakes.take(socket);
+        buffer = &owner->buffer;
+
+        QJsonObject configure;
+        configure["type"] = "configure";
+        configure["params"] = WorkerProtocol::toJson(params);
+        send(owner, configure);
+        dispatch();
+    }
+}
+
+void WorkerPool::onMessage(Worker *worker, const QJsonObject &message) {
+    const QString type = message["type"].toString();
+    const qint64 job = qint64(message["id"].toDouble());
+    const int clip = message["clip"].toInt(-1);
+    if (type == "progress") {
+        emit progressUpdated(job, message["progress"].toInt());
+    } else if (type == "status") {
+        emit statusUpdated(job, clip, message["status"].toString());
+    } else if (type == "clipFinished") {
+        emit clipFinished(job, clip);
+    } else if (type == "output") {
+        emit outputWritten(job, clip, message["file"].toString());
+    } else if (type == "finished") {
+        if (job != worker->job) {
+            qWarning() << "workers: ignoring duplicate finished for job" << job;
+            return;
+        }
+        worker->job = 0;
+        worker->restarts = 0;
+        emit jobFinished(job, message["aborted"].toBool());
+        dispatch();
+    }
+}
+
+void WorkerPool::onExited(Worker *worker) {
+    const qint64 job = worker->job;
+    worker->job = 0;
+    worker->buffer.clear();
+    if (shuttingDown) {
+        return;
+    }
+
+    qWarning() << "workers: process exited" << worker->process->exitCode() << worker->process->errorString();
+    if (job > 0) {
+        // not retried, the same file would most likely crash the next worker as well
+        emit statusUpdated(job, -1, "Worker crashed, file skipped");
+        emit jobFinished(job, false);
+    }
+
+    // back off a little more after every crash in a row
+    if (++worker->restarts > kMaxRestarts) {
+        qWarning("workers: giving up after %d restarts", kMaxRestarts);
+        failPendingIfNoWorkers();
+        return;
+    }
+    QTimer::singleShot(qMin(worker->restarts, 10) * 500, this, [this, worker]() {
+        if (!shuttingDown) {
+            spawn(worker);
+        }
+    });
+}
+
+qint64 WorkerPool::submit(const WorkerJob &job) {
+    WorkerJob queued = job;
+    queued.id = ++lastId;
+    pending.append(queued);
+    dispatch();
+    // reported after returning, the caller connects by the id
+    QTimer::singleShot(0, this, &WorkerPool::failPendingIfNoWorkers);
+    return queued.id;
+}
+
+void WorkerPool::failPendingIfNoWorkers() {
+    for (const auto *worker : workers) {
+        if (worker->restarts <= kMaxRestarts) {
+            return;
+        }
+    }
+    // nobody left to run them, waiting would hang the queue
+    const QList<WorkerJob> failed = pending;
+    pending.clear();
+    for (const auto &job : failed) {
+        emit statusUpdated(job.id, -1, "No worker process could be started");
+        emit jobFinished(job.id, false);
+    }
+}
+
+void WorkerPool::abort(qint64 id) {
+    for (int i = 0; i < pending.size(); ++i) {
+        if (pending.at(i).id == id) {
+            pending.removeAt(i);
+            // reported later, like a running job, so callers aborting several jobs are not reentered
+            QTimer::singleShot(0, this, [this, id]() { emit jobFinished(id, true); });
+            return;
+        }
+    }
+    for (auto *worker : workers) {
+        if (worker->job == id) {
+            QJsonObject message;
+            message["type"] = "abort";
+            message["id"] = id;
+            send(worker, message);
+        }
+    }
+}
+
+void WorkerPool::dispatch() {
+    for (auto *worker : workers) {
+        if (pending.isEmpty()) {
+            return;
+        }
+        if (!worker->socket || worker->job != 0) {
+            continue;
+        }
+
+        const WorkerJob job = pending.takeFirst();
+        QJsonObject message;
+        message["type"] = "job";
+        message["id"] = job.id;
+        message["file"] = job.file;
+        message["output"] = job.outputFolder;
+        message["title"] = job.title;
+        message["link"] = job.link;
+        message["params"] = WorkerProtocol::toJson(job.params);
+        message["placement"] = WorkerProtocol::toJson(job.placement);
+        message["preview"] = job.preview;
+        QJsonArray clips;
+        for (const auto &clip : job.clips) {
+            QJsonObject c;
+            c["file"] = clip.file;
+            c["output"] = clip.outputFolder;
+            c["title"] = clip.title;
+            c["link"] = clip.link;
+            clips.append(c);
+        }
+        message["clips"] = clips;
+
+        worker->job = job.id;
+        send(worker, message);
+    }
+}
+
+void WorkerPool::send(Worker *worker, const QJsonObject &message) {
+    if (worker->socket) {
+        worker->socket->write(WorkerProtocol::frame(message));
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <QByteArray>
+#include <QHash>
+#include <QJsonObject>
+#include <QList>
+#include <QLocalServer>
+#include <QObject>
+#include <QProcess>
+#include <QVector>
+#include "transcriber.h"
+
+class QLocalSocket;
+
+struct WorkerJob {
+    qint64 id = 0;
+    QString file;
+    QString outputFolder;
+    QString title;
+    QString link;
+    whisper_params params;
+    WorkerPlacement placement;
+    QVector<packed_clip> clips;
+    bool preview = false;
+};
+
+// Runs transcriptions in child processes (this executable with --worker), so a crash in
+// whisper or ggml on one file costs that file only. Workers take one job at a time and
+// keep their models loaded between jobs; a worker that dies is started again and its job
+// reported finished without output.
+class WorkerPool : public QObject {
+    Q_OBJECT
+
+public:
+    // params are sent to new workers so they preload the model before the first job
+    WorkerPool(int count, const whisper_params &params, QObject *parent = nullptr);
+    ~WorkerPool();
+
+    // queues the job for the next idle worker and returns its id
+    qint64 submit(const WorkerJob &job);
+    void abort(qint64 id);
+
+signals:
+    void progressUpdated(qint64 job, int progress);
+    void statusUpdated(qint64 job, int clip, const QString &status); // clip -1 is the main file
+    void clipFinished(qint64 job, int clip);
+    void outputWritten(qint64 job, int clip, const QString &file);
+    void jobFinished(qint64 job, bool aborted);
+
+private:
+    struct Worker {
+        QProcess *process = nullptr;
+        QLocalSocket *socket = nullptr;
+        QByteArray buffer;
+        qint64 job = 0;        // running job, 0 when idle
+        int restarts = 0;
+    };
+
+    static const int kMaxRestarts = 20;
+
+    void spawn(Worker *worker);
+    void onNewConnection();
+    void onReadyRead(QLocalSocket *socket);
+    void onMessage(Worker *worker, const QJsonObject &message);
+    void onExited(Worker *worker);
+    void dispatch();
+    void failPendingIfNoWorkers();
+    void send(Worker *worker, const QJsonObject &message);
+
+    QLocalServer server;
+    QList<Worker *> workers;
+    QList<WorkerJob> pending;
+    QHash<QLocalSocket *, QByteArray> handshakes;
+    whisper_params params;
+    qint64 lastId = 0;
+    bool shuttingDown = false;
+};
+
+#endif // WORKERPOOL_H
@@ -0,0 +1,130 @@
+#include "workerprocess.h"
+#include "workerprotocol.h"
+#include "transcriber.h"
+
+#include <QCoreApplication>
+#include <QJsonArray>
+#include <QThread>
+#include <QDebug>
+
+WorkerProcess::WorkerProcess(const QString &serverName, QObject *parent)
+    : QObject(parent), serverName(serverName), abortFlag(false) {
+    connect(&socket, &QLocalSocket::readyRead, this, &WorkerProcess::onReadyRead);
+    connect(&socket, &QLocalSocket::disconnected, this, [this]() {
+        // the supervisor is gone, nobody is left to report to
+        abortFlag.store(true);
+        QCoreApplication::exit(0);
+    });
+}
+
+bool WorkerProcess::start() {
+    socket.connectToServer(serverName);
+    if (!socket.waitForConnected(5000)) {
+        qWarning() << "worker: cannot reach" << serverName << socket.errorString();
+        return false;
+    }
+    QJsonObject hello;
+    hello["type"] = "hello";
+    hello["pid"] = QCoreApplication::applicationPid();
+    send(hello);
+    return true;
+}
+
+void WorkerProcess::onReadyRead() {
+    buffer.append(socket.readAll());
+    QJsonObject message;
+    while (WorkerProtocol::next(buffer, message)) {
+        onMessage(message);
+    }
+}
+
+void WorkerProcess::onMessage(const QJsonObject &message) {
+    const QString type = message["type"].toString();
+    if (type == "configure") {
+        // load and warm up while the supervisor is still queueing jobs
+        Transcriber::preloadModels(WorkerProtocol::paramsFromJson(message["params"].toObject()));
+    } else if (type == "job") {
+        runJob(message);
+    } else if (type == "abort" && qint64(message["id"].toDouble()) == jobId) {
+        abortFlag.store(true);
+    }
+}
+
+void WorkerProcess::runJob(const QJsonObject &job) {
+    if (jobId != 0) {
+        // one job at a time, the supervisor waits for "finished" before sending the next
+        qWarning() << "worker: refusing job" << job["id"].toDouble() << "while running" << jobId;
+        return;
+    }
+    jobId = qint64(job["id"].toDouble());
+    abortFlag.store(false);
+
+    QVector<packed_clip> clips;
+    for (const auto &value : job["clips"].toArray()) {
+        const QJsonObject clip = value.toObject();
+        clips.append({ clip["file"].toString(), clip["output"].toString(), clip["title"].toString(), clip["link"].toString() });
+    }
+
+    // as Transcription does in-process: the transcriber on a thread of its own
+    QThread *thread = new QThread;
+    Transcriber *transcriber = new Transcriber(&abortFlag);
+    transcriber->moveToThread(thread);
+    transcriber->setParams(WorkerProtocol::paramsFromJson(job["params"].toObject()));
+    transcriber->setPlacement(WorkerProtocol::placementFromJson(job["placement"].toObject()));
+    transcriber->setFileAndOutput(job["file"].toString(), job["output"].toString());
+    transcriber->setVideoInfo(job["title"].toString(), job["link"].toString());
+    transcriber->setPackedClips(clips);
+    transcriber->setPreview(job["preview"].toBool());
+
+    const qint64 id = jobId;
+    auto message = [id](const char *type) {
+        QJsonObject result;
+        result["type"] = type;
+        result["id"] = id;
+        return result;
+    };
+    connect(thread, &QThread::started, transcriber, &Transcriber::startTranscription);
+    connect(transcriber, &Transcriber::progressUpdated, this, [this, message](int progress) {
+        QJsonObject m = message("progress");
+        m["progress"] = progress;
+        send(m);
+    });
+    connect(transcriber, &Transcriber::statusUpdated, this, [this, message](const QString &status) {
+        QJsonObject m = message("status");
+        m["status"] = status;
+        send(m);
+    });
+    connect(transcriber, &Transcriber::clipStatusUpdated, this, [this, message](int clip, const QString &status) {
+        QJsonObject m = message("status");
+        m["clip"] = clip;
+        m["status"] = status;
+        send(m);
+    });
+    connect(transcriber, &Transcriber::clipFinished, this, [this, message](int clip) {
+        QJsonObject m = message("clipFinished");
+        m["clip"] = clip;
+        send(m);
+    });
+    connect(transcriber, &Transcriber::outputWritten, this, [this, message](int clip, const QString &file) {
+        QJsonObject m = message("output");
+        m["clip"] = clip;
+        m["file"] = file;
+        send(m);
+    });
+    // transcriptionFinished comes again on every abort poll, the thread only finishes once
+    connect(thread, &QThread::finished, this, [this, message]() {
+        QJsonObject m = message("finished");
+        m["aborted"] = abortFlag.load();
+        send(m);
+        jobId = 0;
+    });
+    connect(transcriber, &Transcriber::transcriptionFinished, thread, &QThread::quit);
+    connect(transcriber, &Transcriber::transcriptionFinished, transcriber, &Transcriber::deleteLater);
+    connect(thread, &QThread::finished, thread, &QThread::deleteLater);
+    thread->start();
+}
+
+void WorkerProcess::send(const QJsonObject &message) {
+    socket.write(WorkerProtocol::frame(message));
+    socket.flush();
+}
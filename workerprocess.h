@@ -0,0 +1,38 @@
+#ifndef WORKERPROCESS_H
+#define WORKERPROCESS_H
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QLocalSocket>
+#include <QObject>
+#include <atomic>
+
+class QThread;
+class Transcriber;
+
+// The child side of WorkerPool, run with --worker <server>: takes one job at a time from
+// the supervisor, transcribes it on its own thread and streams progress back. Exits when
+// the supervisor goes away.
+class WorkerProcess : public QObject {
+    Q_OBJECT
+
+public:
+    explicit WorkerProcess(const QString &serverName, QObject *parent = nullptr);
+
+    // false when the supervisor cannot be reached
+    bool start();
+
+private:
+    void onReadyRead();
+    void onMessage(const QJsonObject &message);
+    void runJob(const QJsonObject &job);
+    void send(const QJsonObject &message);
+
+    QString serverName;
+    QLocalSocket socket;
+    QByteArray buffer;
+    qint64 jobId = 0;
+    std::atomic<bool> abortFlag;
+};
+
+#endif // WORKERPROCESS_H
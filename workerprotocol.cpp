@@ -0,0 +1,204 @@
+#include "workerprotocol.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QtEndian>
+
+QByteArray WorkerProtocol::frame(const QJsonObject &message) {
+    const QByteArray payload = QJsonDocument(message).toJson(QJsonDocument::Compact);
+    QByteArray result(4, 0);
+    qToBigEndian<quint32>(quint32(payload.size()), reinterpret_cast<uchar *>(result.data()));
+    return result + payload;
+}
+
+bool WorkerProtocol::next(QByteArray &buffer, QJsonObject &message) {
+    if (buffer.size() < 4) {
+        return false;
+    }
+    const quint32 size = qFromBigEndian<quint32>(reinterpret_cast<const uchar *>(buffer.constData()));
+    if (size > quint32(kMaxFrameBytes)) {
+        // out of sync, nothing after this can be trusted
+        buffer.clear();
+        message = QJsonObject();
+        return false;
+    }
+    if (quint32(buffer.size()) < 4 + size) {
+        return false;
+    }
+    message = QJsonDocument::fromJson(buffer.mid(4, int(size))).object();
+    buffer.remove(0, int(4 + size));
+    return true;
+}
+
+QJsonObject WorkerProtocol::toJson(const whisper_params &params) {
+    QJsonObject json;
+    json["n_threads"] = params.n_threads;
+    json["n_processors"] = params.n_processors;
+    json["offset_t_ms"] = params.offset_t_ms;
+    json["offset_n"] = params.offset_n;
+    json["duration_ms"] = params.duration_ms;
+    json["progress_step"] = params.progress_step;
+    json["max_context"] = params.max_context;
+    json["max_len"] = params.max_len;
+    json["best_of"] = params.best_of;
+    json["beam_size"] = params.beam_size;
+    json["audio_ctx"] = params.audio_ctx;
+    json["audio_ctx_margin_ms"] = params.audio_ctx_margin_ms;
+    json["mel_cache_mb"] = params.mel_cache_mb;
+    json["model_cache_mb"] = params.model_cache_mb;
+    json["detect_ms"] = params.detect_ms;
+    json["loop_max_repeats"] = params.loop_max_repeats;
+    json["loop_min_chars"] = params.loop_min_chars;
+    json["word_thold"] = double(params.word_thold);
+    json["entropy_thold"] = double(params.entropy_thold);
+    json["logprob_thold"] = double(params.logprob_thold);
+    json["grammar_penalty"] = double(params.grammar_penalty);
+    json["temperature"] = double(params.temperature);
+    json["temperature_inc"] = double(params.temperature_inc);
+    json["loop_similarity"] = double(params.loop_similarity);
+    json["detect_min_p"] = double(params.detect_min_p);
+    json["adaptive_p_thold"] = double(params.adaptive_p_thold);
+    json["debug_mode"] = params.debug_mode;
+    json["translate"] = params.translate;
+    json["detect_language"] = params.detect_language;
+    json["diarize"] = params.diarize;
+    json["tinydiarize"] = params.tinydiarize;
+    json["split_on_word"] = params.split_on_word;
+    json["no_fallback"] = params.no_fallback;
+    json["output_txt"] = params.output_txt;
+    json["output_vtt"] = params.output_vtt;
+    json["output_srt"] = params.output_srt;
+    json["output_wts"] = params.output_wts;
+    json["output_csv"] = params.output_csv;
+    json["output_jsn"] = params.output_jsn;
+    json["output_jsn_full"] = params.output_jsn_full;
+    json["output_lrc"] = params.output_lrc;
+    json["no_prints"] = params.no_prints;
+    json["print_special"] = params.print_special;
+    json["print_colors"] = params.print_colors;
+    json["print_progress"] = params.print_progress;
+    json["no_timestamps"] = params.no_timestamps;
+    json["log_score"] = params.log_score;
+    json["use_gpu"] = params.use_gpu;
+    json["flash_attn"] = params.flash_attn;
+    json["auto_audio_ctx"] = params.auto_audio_ctx;
+    json["beam_search"] = params.beam_search;
+    json["adaptive_beam"] = params.adaptive_beam;
+    json["dual_output"] = params.dual_output;
+    json["mel_cache"] = params.mel_cache;
+    json["language"] = QString::fromStdString(params.language);
+    json["prompt"] = QString::fromStdString(params.prompt);
+    json["model"] = QString::fromStdString(params.model);
+    json["model_variant"] = QString::fromStdString(params.model_variant);
+    json["detect_model"] = QString::fromStdString(params.detect_model);
+    json["preview_model"] = QString::fromStdString(params.preview_model);
+    json["grammar"] = QString::fromStdString(params.grammar);
+    json["grammar_rule"] = QString::fromStdString(params.grammar_rule);
+    json["tdrz_speaker_turn"] = QString::fromStdString(params.tdrz_speaker_turn);
+    json["suppress_regex"] = QString::fromStdString(params.suppress_regex);
+    json["openvino_encode_device"] = QString::fromStdString(params.openvino_encode_device);
+    json["dtw"] = QString::fromStdString(params.dtw);
+
+    QJsonObject languageModels;
+    for (const auto &entry : params.language_models) {
+        languageModels[QString::fromStdString(entry.first)] = QString::fromStdString(entry.second);
+    }
+    json["language_models"] = languageModels;
+    return json;
+}
+
+whisper_params WorkerProtocol::paramsFromJson(const QJsonObject &json) {
+    whisper_params params;
+    params.n_threads = json["n_threads"].toInt(params.n_threads);
+    params.n_processors = json["n_processors"].toInt(params.n_processors);
+    params.offset_t_ms = json["offset_t_ms"].toInt(params.offset_t_ms);
+    params.offset_n = json["offset_n"].toInt(params.offset_n);
+    params.duration_ms = json["duration_ms"].toInt(params.duration_ms);
+    params.progress_step = json["progress_step"].toInt(params.progress_step);
+    params.max_context = json["max_context"].toInt(params.max_context);
+    params.max_len = json["max_len"].toInt(params.max_len);
+    params.best_of = json["best_of"].toInt(params.best_of);
+    params.beam_size = json["beam_size"].toInt(params.beam_size);
+    params.audio_ctx = json["audio_ctx"].toInt(params.audio_ctx);
+    params.audio_ctx_margin_ms = json["audio_ctx_margin_ms"].toInt(params.audio_ctx_margin_ms);
+    params.mel_cache_mb = json["mel_cache_mb"].toInt(params.mel_cache_mb);
+    params.model_cache_mb = json["model_cache_mb"].toInt(params.model_cache_mb);
+    params.detect_ms = json["detect_ms"].toInt(params.detect_ms);
+    params.loop_max_repeats = json["loop_max_repeats"].toInt(params.loop_max_repeats);
+    params.loop_min_chars = json["loop_min_chars"].toInt(params.loop_min_chars);
+    params.word_thold = float(json["word_thold"].toDouble(params.word_thold));
+    params.entropy_thold = float(json["entropy_thold"].toDouble(params.entropy_thold));
+    params.logprob_thold = float(json["logprob_thold"].toDouble(params.logprob_thold));
+    params.grammar_penalty = float(json["grammar_penalty"].toDouble(params.grammar_penalty));
+    params.temperature = float(json["temperature"].toDouble(params.temperature));
+    params.temperature_inc = float(json["temperature_inc"].toDouble(params.temperature_inc));
+    params.loop_similarity = float(json["loop_similarity"].toDouble(params.loop_similarity));
+    params.detect_min_p = float(json["detect_min_p"].toDouble(params.detect_min_p));
+    params.adaptive_p_thold = float(json["adaptive_p_thold"].toDouble(params.adaptive_p_thold));
+    params.debug_mode = json["debug_mode"].toBool(params.debug_mode);
+    params.translate = json["translate"].toBool(params.translate);
+    params.detect_language = json["detect_language"].toBool(params.detect_language);
+    params.diarize = json["diarize"].toBool(params.diarize);
+    params.tinydiarize = json["tinydiarize"].toBool(params.tinydiarize);
+    params.split_on_word = json["split_on_word"].toBool(params.split_on_word);
+    params.no_fallback = json["no_fallback"].toBool(params.no_fallback);
+    params.output_txt = json["output_txt"].toBool(params.output_txt);
+    params.output_vtt = json["output_vtt"].toBool(params.output_vtt);
+    params.output_srt = json["output_srt"].toBool(params.output_srt);
+    params.output_wts = json["output_wts"].toBool(params.output_wts);
+    params.output_csv = json["output_csv"].toBool(params.output_csv);
+    params.output_jsn = json["output_jsn"].toBool(params.output_jsn);
+    params.output_jsn_full = json["output_jsn_full"].toBool(params.output_jsn_full);
+    params.output_lrc = json["output_lrc"].toBool(params.output_lrc);
+    params.no_prints = json["no_prints"].toBool(params.no_prints);
+    params.print_special = json["print_special"].toBool(params.print_special);
+    params.print_colors = json["print_colors"].toBool(params.print_colors);
+    params.print_progress = json["print_progress"].toBool(params.print_progress);
+    params.no_timestamps = json["no_timestamps"].toBool(params.no_timestamps);
+    params.log_score = json["log_score"].toBool(params.log_score);
+    params.use_gpu = json["use_gpu"].toBool(params.use_gpu);
+    params.flash_attn = json["flash_attn"].toBool(params.flash_attn);
+    params.auto_audio_ctx = json["auto_audio_ctx"].toBool(params.auto_audio_ctx);
+    params.beam_search = json["beam_search"].toBool(params.beam_search);
+    params.adaptive_beam = json["adaptive_beam"].toBool(params.adaptive_beam);
+    params.dual_output = json["dual_output"].toBool(params.dual_output);
+    params.mel_cache = json["mel_cache"].toBool(params.mel_cache);
+    params.language = json["language"].toString(QString::fromStdString(params.language)).toStdString();
+    params.prompt = json["prompt"].toString(QString::fromStdString(params.prompt)).toStdString();
+    params.model = json["model"].toString(QString::fromStdString(params.model)).toStdString();
+    params.model_variant = json["model_variant"].toString(QString::fromStdString(params.model_variant)).toStdString();
+    params.detect_model = json["detect_model"].toString(QString::fromStdString(params.detect_model)).toStdString();
+    params.preview_model = json["preview_model"].toString(QString::fromStdString(params.preview_model)).toStdString();
+    params.grammar = json["grammar"].toString(QString::fromStdString(params.grammar)).toStdString();
+    params.grammar_rule = json["grammar_rule"].toString(QString::fromStdString(params.grammar_rule)).toStdString();
+    params.tdrz_speaker_turn = json["tdrz_speaker_turn"].toString(QString::fromStdString(params.tdrz_speaker_turn)).toStdString();
+    params.suppress_regex = json["suppress_regex"].toString(QString::fromStdString(params.suppress_regex)).toStdString();
+    params.openvino_encode_device = json["openvino_encode_device"].toString(QString::fromStdString(params.openvino_encode_device)).toStdString();
+    params.dtw = json["dtw"].toString(QString::fromStdString(params.dtw)).toStdString();
+
+    const QJsonObject languageModels = json["language_models"].toObject();
+    for (auto it = languageModels.begin(); it != languageModels.end(); ++it) {
+        params.language_models[it.key().toStdString()] = it.value().toString().toStdString();
+    }
+    return params;
+}
+
+QJsonObject WorkerProtocol::toJson(const WorkerPlacement &placement) {
+    QJsonObject json;
+    json["node"] = placement.node;
+    QJsonArray cpus;
+    for (int cpu : placement.cpus) {
+        cpus.append(cpu);
+    }
+    json["cpus"] = cpus;
+    return json;
+}
+
+WorkerPlacement WorkerProtocol::placementFromJson(const QJsonObject &json) {
+    WorkerPlacement placement;
+    placement.node = json["node"].toInt(-1);
+    for (const auto &cpu : json["cpus"].toArray()) {
+        placement.cpus.append(cpu.toInt());
+    }
+    return placement;
+}
@@ -0,0 +1,33 @@
+#ifndef WORKERPROTOCOL_H
+#define WORKERPROTOCOL_H
+
+#include <QByteArray>
+#include <QJsonObject>
+#include <QString>
+#include "transcriber.h"
+
+// Messages between the supervisor and its worker processes: compact JSON objects, each
+// preceded by its length as a 32-bit big-endian integer. Every message has a "type":
+//
+//   supervisor -> worker   configure {params}, job {id, file, output, title, link, params,
+//                          preview, clips, placement}, abort {id}
+//   worker -> supervisor   hello {pid}, progress {id, progress}, status {id, clip, status},
+//                          clipFinished {id, clip}, output {id, clip, file}, finished {id, aborted}
+class WorkerProtocol {
+public:
+    static QByteArray frame(const QJsonObject &message);
+
+    // takes the next complete message off the front of buffer, false until one has arrived
+    static bool next(QByteArray &buffer, QJsonObject &message);
+
+    static QJsonObject toJson(const whisper_params &params);
+    static whisper_params paramsFromJson(const QJsonObject &json);
+
+    static QJsonObject toJson(const WorkerPlacement &placement);
+    static WorkerPlacement placementFromJson(const QJsonObject &json);
+
+    // frames larger than this are a protocol error, not a message
+    static const int kMaxFrameBytes = 16 * 1024 * 1024;
+};
+
+#endif // WORKERPROTOCOL_H